@@ -7,34 +7,223 @@ import serial
 import select
 import time
 import getopt
+import zlib
 import tqdm
 
+# see the protocol description in bootloader.c
+MAGIC = b'MEOW'
+BLOCK_SIZE = 8192
+# LOAD_LIMIT of bootloader.c, the rest of the 8 MiB is its stack
+LOAD_LIMIT = 0x800000 - 0x4000
+UART_CLOCK = 100000000
+DEFAULT_BAUD = 115200
+# 100M / 16 / divisor, fastest first
+DIVISORS = [1, 2, 3, 4, 6, 9, 13, 27]
+MAX_MATCH = 0x7f + 3
+MAX_LITERAL = 0x80
+MAX_DIST = 0xffff
+# consecutive failures of one block before stepping down to the next
+# divisor, and before giving up
+SLOW_DOWN_FAILURES = 3
+MAX_FAILURES = 12
+
+
+def compress(data, begin, end, table):
+    # greedy lz with one candidate per 3-byte prefix, table is shared
+    # between blocks so copies can reach into earlier blocks
+    out = bytearray()
+    literal = begin
+    i = begin
+    while i + 3 <= end:
+        key = data[i:i+3]
+        cand = table.get(key, -1)
+        table[key] = i
+        if cand < 0 or i - cand > MAX_DIST:
+            i += 1
+            continue
+        length = 3
+        limit = min(MAX_MATCH, end - i)
+        while length < limit and data[cand+length] == data[i+length]:
+            length += 1
+        while literal < i:
+            n = min(MAX_LITERAL, i - literal)
+            out.append(n - 1)
+            out += data[literal:literal+n]
+            literal += n
+        out.append(0x80 + length - 3)
+        out += struct.pack('<H', i - cand)
+        for j in range(i + 1, min(i + length, end - 2)):
+            table[data[j:j+3]] = j
+        i += length
+        literal = i
+    while literal < end:
+        n = min(MAX_LITERAL, end - literal)
+        out.append(n - 1)
+        out += data[literal:literal+n]
+        literal += n
+    return bytes(out)
+
+
+def expect(out, replies, timeout=1.0):
+    # first byte among replies, None on timeout
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        ch = out.read(1)
+        if ch in replies:
+            return ch
+    return None
+
+
+def sync(out):
+    for _ in range(8):
+        out.write(b'S')
+        if expect(out, [b'K'], 0.2):
+            time.sleep(0.05)
+            out.reset_input_buffer()
+            return True
+    return False
+
+
+def baud_rate(index):
+    # index into DIVISORS, len(DIVISORS) for DEFAULT_BAUD
+    if index == len(DIVISORS):
+        return DEFAULT_BAUD
+    return UART_CLOCK // 16 // DIVISORS[index]
+
+
+def fall_back(out):
+    # board reverts after about a second without sync
+    out.baudrate = DEFAULT_BAUD
+    time.sleep(3)
+    out.reset_input_buffer()
+    if not sync(out):
+        raise RuntimeError('Lost sync at {}'.format(DEFAULT_BAUD))
+    return len(DIVISORS)
+
+
+def negotiate(out, max_baud, start=0, current=len(DIVISORS)):
+    # switch to the fastest divisor from start on, returns the index of the
+    # rate in use, see baud_rate
+    for index in range(start, len(DIVISORS)):
+        baud = baud_rate(index)
+        if baud > max_baud:
+            continue
+        out.write(b'B' + struct.pack('<H', DIVISORS[index]))
+        if expect(out, [b'A']) is None:
+            # either the board missed the command or switched without us
+            if not sync(out):
+                current = fall_back(out)
+            break
+        time.sleep(0.01)
+        out.baudrate = baud
+        time.sleep(0.01)
+        out.reset_input_buffer()
+        if sync(out):
+            return index
+        print('Baud rate {} failed'.format(baud))
+        current = fall_back(out)
+    return current
+
+
+def send_framed(out, data, max_baud, compressed):
+    if len(data) > LOAD_LIMIT:
+        raise RuntimeError('{} bytes do not fit below the bootloader stack, '
+                           'at most {}'.format(len(data), LOAD_LIMIT))
+    out.write(MAGIC)
+    if expect(out, [b'K'], 2.0) is None:
+        raise RuntimeError('No handshake, is the board in the bootloader?')
+    index = negotiate(out, max_baud)
+    print('Running at {} baud'.format(baud_rate(index)))
+
+    table = {}
+    sent = 0
+    retries = 0
+    with tqdm.tqdm(total=len(data), unit='B', unit_scale=True) as bar:
+        for begin in range(0, len(data), BLOCK_SIZE):
+            end = min(begin + BLOCK_SIZE, len(data))
+            payload = compress(data, begin, end, table) if compressed else b''
+            if len(payload) >= end - begin:
+                # stored
+                payload = b''
+            header = struct.pack('<IHH', begin, end - begin, len(payload))
+            body = header + (payload or data[begin:end])
+            frame = b'L' + body + struct.pack('<I', zlib.crc32(body))
+            # stop and wait, resend only this block on error or timeout
+            failures = 0
+            while True:
+                out.write(frame)
+                reply = expect(out, [b'Y', b'N'], 2.0)
+                if reply == b'Y':
+                    break
+                retries += 1
+                failures += 1
+                if failures >= MAX_FAILURES:
+                    raise RuntimeError('Block {:x} failed {} times'.format(
+                        begin, failures))
+                if reply is None:
+                    # let the board time out of a partial frame
+                    time.sleep(1.5)
+                    out.reset_input_buffer()
+                    if not sync(out):
+                        raise RuntimeError(
+                            'Lost sync at block {:x}'.format(begin))
+                if (failures % SLOW_DOWN_FAILURES == 0 and
+                        index < len(DIVISORS)):
+                    index = negotiate(out, max_baud, index + 1, index)
+                    print('Slowing down to {} baud'.format(baud_rate(index)))
+            sent += len(frame)
+            bar.update(end - begin)
+
+    out.write(b'G')
+    expect(out, [b'Y'])
+    print('Sent {} bytes for {} ({:.1f}%), {} retries'.format(
+        sent, len(data), sent * 100.0 / max(len(data), 1), retries))
+
+
 try:
-    optlist, args = getopt.getopt(sys.argv[1:], 's')
+    optlist, args = getopt.getopt(sys.argv[1:], 'srFnb:')
 
     timeout = 0.01
     n = 1024
     slow = False
+    # the checked in bootrom.img predates the framed protocol, pass -F with
+    # a bootrom rebuilt from bootloader.c
+    raw = True
+    compressed = True
+    max_baud = UART_CLOCK // 16
 
     for o, a in optlist:
         if o == "-s":
             slow = True
+            raw = True
             n = 16
             print('Running in slow mode')
+        elif o == "-r":
+            raw = True
+        elif o == "-F":
+            raw = False
+        elif o == "-n":
+            compressed = False
+        elif o == "-b":
+            max_baud = int(a)
 
-    out = serial.Serial(args[1], 115200, timeout=timeout)
+    out = serial.Serial(args[1], DEFAULT_BAUD, timeout=timeout)
 
-    size = os.path.getsize(args[0])
-    out.write(struct.pack('>I', size))
     with open(args[0], 'rb') as f:
         data = f.read()
+
+    if raw:
+        # legacy protocol: length and raw bytes at 115200
+        out.write(struct.pack('>I', len(data)))
         for i in tqdm.tqdm(range(0, len(data), n)):
             out.write(data[i:i+n])
             if slow:
                 time.sleep(timeout)
+    else:
+        send_framed(out, data, max_baud, compressed)
 
     out.close()
-    os.execlp('screen', 'screen', '-L', args[1], '115200')
+    os.execlp('screen', 'screen', '-L', args[1], str(DEFAULT_BAUD))
 except getopt.GetoptError as err:
     print(str(err))
-    print('Usage: send.py [-s] file tty')
+    print('Usage: send.py [-s] [-r | -F] [-n] [-b max_baud] file tty')
@@ -12,16 +12,22 @@ volatile uint8_t *UART_MCR = (uint8_t *)(UART_BASE + 0x1010);
 volatile uint8_t *UART_LSR = (uint8_t *)(UART_BASE + 0x1014);
 volatile int *CLINT = (int *)0x2000000;
 
-void init_serial() {
-  // Enable 8 bytes FIFO
-  *UART_FCR = 0x81;
+// 115200: 100M / 16 / 115200 = 54
+const uint16_t UART_DIVISOR_DEFAULT = 54;
+
+void set_divisor(uint16_t divisor) {
   // LCR(7) = 1
   *UART_LCR = 0x80;
-  // 115200: 100M / 16 / 115200 = 54
-  *UART_DLL = 54;
-  *UART_DLM = 0;
+  *UART_DLL = divisor & 0xFF;
+  *UART_DLM = divisor >> 8;
   // LCR(7) = 0, 8N1
   *UART_LCR = ~0x80 & 0x03;
+}
+
+void init_serial() {
+  // Enable 8 bytes FIFO
+  *UART_FCR = 0x81;
+  set_divisor(UART_DIVISOR_DEFAULT);
   *UART_MCR = 0;
   *UART_IER = 0;
 }
@@ -38,6 +44,24 @@ uint8_t getc() {
   return *UART_RBR;
 }
 
+// about a second of LSR polls over the MMIO bus
+const uint32_t GETC_TIMEOUT = 1 << 20;
+
+// -1 on timeout
+int getc_timeout() {
+  for (uint32_t i = 0; i < GETC_TIMEOUT; i++) {
+    if (*UART_LSR & 0x1) {
+      return *UART_RBR;
+    }
+  }
+  return -1;
+}
+
+void flush_tx() {
+  while (!(*UART_LSR & 0x40))
+    ;
+}
+
 uint32_t getlen() {
   uint32_t len = 0;
   len |= getc();
@@ -70,19 +94,206 @@ void puthex(uint32_t num) {
   }
 }
 
+// framed protocol of boot.py, started by MAGIC in place of the length
+// all integers are little endian
+//
+// host -> board, board replies with a single byte:
+//   'S'                      sync, 'K'
+//   'B' divisor:2            'A' at the old rate, then switch and wait for
+//                            'S' at the new rate, reverts to 115200 if none
+//   'L' offset:4 len:2 clen:2 payload crc:4
+//                            block decoded to DRAM + offset, clen = 0 means
+//                            stored, crc32 covers everything after 'L',
+//                            'Y' if written, 'N' to resend or if the block
+//                            ends above LOAD_LIMIT
+//   'G'                      'Y', back to 115200 and boot
+//
+// compressed payload is a sequence of tokens:
+//   0x00-0x7F  literal run of (token + 1) bytes that follow
+//   0x80-0xFF  copy (token - 0x80 + 3) bytes from dist:2 bytes back,
+//              may reach into earlier blocks
+const uint32_t MAGIC = 0x4D454F57; // "MEOW" read by getlen()
+const uint32_t BLOCK_SIZE = 8192;
+// sp starts at DRAM_TOP in bootrom.S, load_framed keeps the payload buffer
+// and crc table on the stack, so images are limited to 8 MiB - 16 KiB
+const uint32_t LOAD_LIMIT = 0x800000 - 0x4000;
+
+// tables live on the stack, the rom has no writable data
+void init_crc(uint32_t *crc_table) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+    }
+    crc_table[i] = crc;
+  }
+}
+
+uint32_t crc_update(uint32_t *crc_table, uint32_t crc, uint8_t *buf,
+                    uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) {
+    crc = crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+// -1 on timeout
+int read_timeout(uint8_t *buf, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) {
+    int ch = getc_timeout();
+    if (ch < 0) {
+      return -1;
+    }
+    buf[i] = ch;
+  }
+  return 0;
+}
+
+// 0 if exactly len bytes are produced
+int decompress(uint8_t *out, uint32_t len, uint8_t *in, uint32_t clen) {
+  uint8_t *begin = (uint8_t *)0x80000000;
+  uint8_t *end = out + len;
+  uint8_t *in_end = in + clen;
+  while (in < in_end) {
+    uint8_t token = *in++;
+    if (token < 0x80) {
+      uint32_t count = token + 1;
+      if (count > in_end - in || count > end - out) {
+        return -1;
+      }
+      while (count--) {
+        *out++ = *in++;
+      }
+    } else {
+      uint32_t count = token - 0x80 + 3;
+      if (in_end - in < 2) {
+        return -1;
+      }
+      uint32_t dist = in[0] | (in[1] << 8);
+      in += 2;
+      if (dist == 0 || dist > out - begin || count > end - out) {
+        return -1;
+      }
+      uint8_t *from = out - dist;
+      while (count--) {
+        *out++ = *from++;
+      }
+    }
+  }
+  return out == end ? 0 : -1;
+}
+
+// 0 if written, -1 to resend
+int load_block(uint32_t *crc_table) {
+  // offset, len, clen, crc, then payload up to the stored size
+  uint8_t header[8];
+  uint8_t payload[BLOCK_SIZE];
+  uint8_t tail[4];
+  if (read_timeout(header, sizeof(header))) {
+    return -1;
+  }
+  uint32_t offset = header[0] | (header[1] << 8) | (header[2] << 16) |
+                    ((uint32_t)header[3] << 24);
+  uint32_t len = header[4] | (header[5] << 8);
+  uint32_t clen = header[6] | (header[7] << 8);
+  uint32_t size = clen ? clen : len;
+  if (len > BLOCK_SIZE || size > BLOCK_SIZE) {
+    return -1;
+  }
+  if (read_timeout(payload, size) || read_timeout(tail, sizeof(tail))) {
+    return -1;
+  }
+  uint32_t crc = crc_update(crc_table, 0xFFFFFFFF, header, sizeof(header));
+  crc = ~crc_update(crc_table, crc, payload, size);
+  uint32_t expected = tail[0] | (tail[1] << 8) | (tail[2] << 16) |
+                      ((uint32_t)tail[3] << 24);
+  if (crc != expected) {
+    return -1;
+  }
+  // checked after the whole frame is consumed, would overwrite our stack
+  if (offset > LOAD_LIMIT || len > LOAD_LIMIT - offset) {
+    return -1;
+  }
+
+  uint8_t *out = (uint8_t *)0x80000000 + offset;
+  if (clen) {
+    return decompress(out, len, payload, clen);
+  }
+  for (uint32_t i = 0; i < len; i++) {
+    out[i] = payload[i];
+  }
+  return 0;
+}
+
+void switch_baud() {
+  uint8_t divisor[2];
+  if (read_timeout(divisor, sizeof(divisor))) {
+    return;
+  }
+  putc('A');
+  flush_tx();
+  set_divisor(divisor[0] | (divisor[1] << 8));
+  // drop anything received during the switch
+  *UART_FCR = 0x83;
+  for (;;) {
+    int ch = getc_timeout();
+    if (ch == 'S') {
+      putc('K');
+      return;
+    } else if (ch < 0) {
+      // host gave up on this rate
+      set_divisor(UART_DIVISOR_DEFAULT);
+      *UART_FCR = 0x83;
+      return;
+    }
+  }
+}
+
+void load_framed() {
+  uint32_t crc_table[256];
+  init_crc(crc_table);
+  // handshake
+  putc('K');
+  for (;;) {
+    switch (getc()) {
+    case 'S':
+      putc('K');
+      break;
+    case 'B':
+      switch_baud();
+      break;
+    case 'L':
+      putc(load_block(crc_table) ? 'N' : 'Y');
+      break;
+    case 'G':
+      putc('Y');
+      flush_tx();
+      set_divisor(UART_DIVISOR_DEFAULT);
+      return;
+    default:
+      // noise, wait for the next command
+      break;
+    }
+  }
+}
+
 void bootloader(int mhartid) {
   void (*boot)() = (void (*)())0x80000000;
   // Boot Hart
   init_serial();
   puts("NO BOOT FAIL\r\n");
   uint32_t len = getlen();
-  puts("LEN ");
-  puthex(len);
-  puts("\r\n");
-  volatile uint8_t *MEM = (uint8_t *)0x80000000;
-  for (uint32_t i = 0; i < len; i++) {
-    *MEM = getc();
-    MEM++;
+  if (len == MAGIC) {
+    load_framed();
+  } else {
+    puts("LEN ");
+    puthex(len);
+    puts("\r\n");
+    volatile uint8_t *MEM = (uint8_t *)0x80000000;
+    for (uint32_t i = 0; i < len; i++) {
+      *MEM = getc();
+      MEM++;
+    }
   }
   puts("BOOT\r\n");
   // ask hart 1 to jump
@@ -214,6 +214,12 @@ class L1DC(val opts: L1DOpts)(implicit coredef: CoreDef) extends Module {
   val fs = IO(Flipped(new DCFenceStatus(opts)))
   val toL2 = IO(new L1DCPort(opts))
 
+  // hpm events
+  val perf = IO(Output(new Bundle {
+    val miss = Bool()
+    val writeback = Bool()
+  }))
+
   // Convert mr + ptw to r
   val rArbiter = Module(new RRArbiter(new CoreDCReadReq(opts), 2))
   class RReq extends Bundle {
@@ -632,6 +638,11 @@ class L1DC(val opts: L1DOpts)(implicit coredef: CoreDef) extends Module {
     }
   }
 
+  // read miss or write allocation
+  perf.miss := (state === MainState.idle && nstate === MainState.reading) ||
+    (state === MainState.writing && nstate === MainState.walloc)
+  perf.writeback := toL2.l1req === L1DCPort.L1Req.writeback && !toL2.l1stall
+
   // Handle write interface
   // This operates synchronously
   val wmHits = wbuf.map(ev => ev.valid && ev.aligned === w.aligned)
@@ -23,6 +23,10 @@ class L1IC(opts: L1Opts) extends Module {
   // uncached inst
   val toUI = IO(new L1ICPort(opts))
 
+  // refill started, for hpm
+  val miss = IO(Output(Bool()))
+  miss := false.B
+
   toCPU.data := DontCare
   toL2.read.bits := DontCare
   toL2.read.valid := false.B
@@ -177,6 +181,7 @@ class L1IC(opts: L1Opts) extends Module {
           toCPU.data.valid := true.B
           toCPU.data.bits := rdata(getTransferOffset(pipeAddr))
         }.otherwise {
+          miss := true.B
           nstate := S2State.refill
         }
       }.otherwise {
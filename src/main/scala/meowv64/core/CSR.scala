@@ -22,12 +22,6 @@ object CSRHelper {
     csr.readers("mimpid") := 0.U(csr.XLEN.W)
     csr.readers("misa") := 2.U(2.W) ## 0
       .U((csr.XLEN - 2 - 26).W) ## CSRHelper.buildExt("IMAFDCSUV").U(26.W)
-    // allow cycle, time and instret to be read from S/U-mode
-    // validated by OpenSBI since v1.6 to enable time csr emulation
-    csr.readers("mcounteren") := 7.U(
-      csr.XLEN.W
-    )
-    csr.readers("scounteren") := 0.U(csr.XLEN.W)
   }
 }
 
@@ -91,6 +85,16 @@ class CSR(val XLEN: Int) {
   }
 }
 
+/** Counter access from lower privilege levels
+  *
+  * Bit i enables cycle, time, instret or hpmcounter{i} in S-mode (mcounteren)
+  * and U-mode (mcounteren and scounteren)
+  */
+class CounterEn extends Bundle {
+  val mcounteren = UInt(32.W)
+  val scounteren = UInt(32.W)
+}
+
 class VState(implicit coredef: CoreDef) extends Bundle {
   // vl <= vlen
   val vl = UInt(log2Ceil(coredef.VLEN + 1).W)
@@ -145,7 +149,7 @@ object CSR {
     0x303 -> (("mideleg", true)),
     0x304 -> (("mie", true)),
     0x305 -> (("mtvec", true)),
-    0x306 -> (("mcounteren", false)), // TODO: impl counter
+    0x306 -> (("mcounteren", true)),
     0x320 -> (("mcountinhibit", true)),
     0x340 -> (("mscratch", true)),
     0x341 -> (("mepc", true)),
@@ -165,7 +169,7 @@ object CSR {
     // 0x103 -> (("sideleg", true)),
     0x104 -> (("sie", true)),
     0x105 -> (("stvec", true)),
-    0x106 -> (("scounteren", false)),
+    0x106 -> (("scounteren", true)),
     0x140 -> (("sscratch", true)),
     0x141 -> (("sepc", true)),
     0x142 -> (("scause", true)),
@@ -176,6 +180,13 @@ object CSR {
     // User
     0xc00 -> (("cycle", false)),
     0xc02 -> (("instret", false))
+  ) ++ (3 until 32).flatMap(i =>
+    Seq(
+      // hpm counters, see PerfEvents
+      (0xb00 + i) -> ((s"mhpmcounter$i", true)),
+      (0x320 + i) -> ((s"mhpmevent$i", true)),
+      (0xc00 + i) -> ((s"hpmcounter$i", false))
+    )
   )
 
   /*
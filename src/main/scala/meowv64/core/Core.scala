@@ -42,6 +42,151 @@ class CoreDebug(implicit val coredef: CoreDef) extends Bundle {
   val issueNumBoundedByROBSize = Bool()
   val issueNumBoundedByLSQSize = Bool()
   val retireNum = UInt(log2Ceil(coredef.ISSUE_NUM + 1).W)
+
+  // any interrupt enabled in mie, i.e. core may be woken up by interrupts,
+  // lets the harness tell a parked hart from a deadlocked one
+  val intEnabled = Bool()
+
+  // retired instructions, for lockstep co-simulation
+  val retire =
+    if (coredef.RETIRE_TRACE) Some(Vec(coredef.RETIRE_NUM, new RetireTrace))
+    else None
+
+  // top-down slots of this cycle
+  val topDown = new TopDownEvents
+}
+
+/** Top-down breakdown of issue slots in one cycle
+  *
+  * Every cycle has ISSUE_NUM issue slots. An empty slot is frontend bound if
+  * the frontend provides no instruction, or backend bound if the instruction
+  * is blocked from issue. Issued slots are later counted as retiring, or as
+  * bad speculation when flushed. Slots lost in the recovery after a flush are
+  * counted as bad speculation as well.
+  */
+class TopDownEvents(implicit val coredef: CoreDef) extends Bundle {
+  val width = log2Ceil(coredef.INFLIGHT_INSTR_LIMIT + coredef.ISSUE_NUM + 1)
+
+  val frontendBound = UInt(width.W)
+  val badSpeculation = UInt(width.W)
+
+  /** Backend bound slots with the oldest instruction waiting for memory, or
+    * with LSQ full
+    */
+  val backendMemoryBound = UInt(width.W)
+
+  /** Other backend bound slots, e.g. full issue queue or busy divider
+    */
+  val backendCoreBound = UInt(width.W)
+  val retiring = UInt(width.W)
+
+  /** Frontend bound slots while waiting for I$ or ITLB
+    */
+  val frontendICacheMiss = UInt(width.W)
+
+  /** Frontend bound slots after a fetch redirect by BPU
+    */
+  val frontendRedirect = UInt(width.W)
+
+  def asSeq =
+    Seq(
+      frontendBound,
+      badSpeculation,
+      backendMemoryBound,
+      backendCoreBound,
+      retiring,
+      frontendICacheMiss,
+      frontendRedirect
+    )
+}
+
+object TopDownEvents {
+  // number of events in asSeq
+  val COUNT = 7
+}
+
+/** Events counted by hpm counters, each is the count in the current cycle
+  *
+  * mhpmeventN selects the event counted by mhpmcounterN:
+  *   - 0: none
+  *   - 1-7: top-down events, see TopDownEvents
+  *   - 8: L1I miss
+  *   - 9: L1D miss
+  *   - 10: L1D writeback
+  *   - 11: ITLB miss
+  *   - 12: DTLB miss
+  *   - 13: PTW walk
+  *   - 14: BRANCH/JAL mispredict
+  *   - 15: JALR mispredict
+  *   - 16: ROB full cycle
+  *   - 17: LSQ full cycle
+  *   - 18: vector instruction retired
+  *   - 19: Buffets read stall cycle
+  *   - 20 and up: issue queue full cycle, one for each issue queue
+  *
+  * mhpmcounter3..9 count events 1..7 after reset
+  */
+class PerfEvents(implicit val coredef: CoreDef) extends Bundle {
+  val topDown = new TopDownEvents
+  val l1iMiss = Bool()
+  val l1dMiss = Bool()
+  val l1dWriteback = Bool()
+  val itlbMiss = Bool()
+  val dtlbMiss = Bool()
+  val ptwWalk = Bool()
+  val branchMispredict = Bool()
+  val jalrMispredict = Bool()
+  val robFull = Bool()
+  val lsqFull = Bool()
+  val vectorRetired = UInt(log2Ceil(coredef.RETIRE_NUM + 1).W)
+  val buffetsStall = Bool()
+  val iqFull = UInt(coredef.ISSUE_QUEUES.length.W)
+
+  // in the order of event numbers, starting from 1
+  def asSeq: Seq[UInt] =
+    topDown.asSeq ++ Seq(
+      l1iMiss,
+      l1dMiss,
+      l1dWriteback,
+      itlbMiss,
+      dtlbMiss,
+      ptwWalk,
+      branchMispredict,
+      jalrMispredict,
+      robFull,
+      lsqFull,
+      vectorRetired,
+      buffetsStall
+    ).map(_.asUInt) ++ iqFull.asBools.map(_.asUInt)
+}
+
+object PerfEvents {
+  // mhpmcounter3..31
+  val HPM_COUNT = 29
+}
+
+/** One retired instruction, without those trapped by exceptions
+  */
+class RetireTrace(implicit val coredef: CoreDef) extends Bundle {
+  val valid = Bool()
+  val pc = UInt(coredef.XLEN.W)
+  val instr = UInt(32.W)
+
+  /** Write to integer or float register rd
+    */
+  val wen = Bool()
+  val rdFloat = Bool()
+  val rd = UInt(5.W)
+  val wdata = UInt(coredef.XLEN.W)
+
+  /** Scalar store performed by this instruction, only in the first slot
+    *
+    * storeBe selects the low bytes of storeData that are written to storeAddr
+    */
+  val store = Bool()
+  val storeAddr = UInt(coredef.XLEN.W)
+  val storeData = UInt(coredef.XLEN.W)
+  val storeBe = UInt((coredef.XLEN / 8).W)
 }
 
 class CoreToDebugModule extends Bundle {
@@ -129,6 +274,25 @@ class Core(implicit val coredef: CoreDef) extends Module {
   ras.toExec.realign.valid := false.B
 
   exec.toIF <> fetch.toExec
+  exec.toCore.fetchICacheMiss := fetch.debug.icacheMiss
+  exec.toCore.fetchRedirect := fetch.debug.redirect
+
+  val perf = Wire(new PerfEvents)
+  perf.topDown := exec.toCore.topDown
+  perf.l1iMiss := l1i.miss
+  perf.l1dMiss := l1d.perf.miss
+  perf.l1dWriteback := l1d.perf.writeback
+  perf.itlbMiss := fetch.debug.itlbMiss
+  perf.dtlbMiss := exec.toCore.dtlbMiss
+  perf.ptwWalk := ptw.walk
+  perf.branchMispredict := exec.toCore.branchMispredict
+  perf.jalrMispredict := exec.toCore.jalrMispredict
+  perf.robFull := exec.toCore.robFull
+  perf.lsqFull := exec.toCore.lsqFull
+  perf.vectorRetired := exec.toCore.vectorRetired
+  perf.buffetsStall := exec.toCore.buffetsStall
+  perf.iqFull := exec.toCore.iqFullMask
+  ctrl.perf := perf
   for (i <- 0 until coredef.REG_TYPES.length) {
     var readIdx = 0
     var writeIdx = 0
@@ -192,6 +356,7 @@ class Core(implicit val coredef: CoreDef) extends Module {
   ctrl.toExec.frm <> exec.toCtrl.frm
   ctrl.toExec.step <> exec.toCtrl.step
   ctrl.toExec.stepAck := exec.toCtrl.stepAck
+  ctrl.toExec.counteren <> exec.toCtrl.counteren
 
   ctrl.int := io.int
 
@@ -210,6 +375,8 @@ class Core(implicit val coredef: CoreDef) extends Module {
   csr.attach("mie").connect(ctrl.csr.mie)
   csr.attach("mip").connect(ctrl.csr.mip)
   csr.attach("mcountinhibit").connect(ctrl.csr.mcountinhibit)
+  csr.attach("mcounteren").connect(ctrl.csr.mcounteren)
+  csr.attach("scounteren").connect(ctrl.csr.scounteren)
   csr.attach("mideleg").connect(ctrl.csr.mideleg)
   csr.attach("medeleg").connect(ctrl.csr.medeleg)
   csr.attach("pmpaddr0").connect(ctrl.csr.pmpaddr0)
@@ -257,6 +424,11 @@ class Core(implicit val coredef: CoreDef) extends Module {
 
   csr.readers("cycle") := ctrl.csr.cycle
   csr.readers("instret") := ctrl.csr.instret
+  for (i <- 0 until PerfEvents.HPM_COUNT) {
+    csr.attach(s"mhpmcounter${i + 3}").connect(ctrl.csr.mhpmcounter(i))
+    csr.attach(s"mhpmevent${i + 3}").connect(ctrl.csr.mhpmevent(i))
+    csr.readers(s"hpmcounter${i + 3}") := ctrl.csr.hpmcounter(i)
+  }
 
   ptw.satp := satp
   fetch.toCore.satp := satp
@@ -271,4 +443,9 @@ class Core(implicit val coredef: CoreDef) extends Module {
   io.debug.issueNumBoundedByLSQSize := exec.toCore.issueNumBoundedByLSQSize
   io.debug.retireNum := exec.toCore.retireNum
   io.debug.pc := exec.toCore.retirePc
+  io.debug.intEnabled := ctrl.csr.mie.rdata.orR
+  io.debug.retire.zip(exec.toCore.retireTrace).foreach { case (d, e) =>
+    d := e
+  }
+  io.debug.topDown := exec.toCore.topDown
 }
@@ -125,10 +125,14 @@ class Ctrl(implicit coredef: CoreDef) extends Module {
       */
     val updateFState = Input(new UpdateFState)
     val updateVState = Flipped(Valid(new VState))
+
+    val counteren = Output(new CounterEn)
   })
 
   val int = IO(Input(new CoreInt))
 
+  val perf = IO(Input(new PerfEvents))
+
   val csr = IO(new Bundle {
     val mcycle = new CSRPort(coredef.XLEN)
     val minstret = new CSRPort(coredef.XLEN)
@@ -140,6 +144,8 @@ class Ctrl(implicit coredef: CoreDef) extends Module {
     val mcause = new CSRPort(coredef.XLEN)
     val mtval = new CSRPort(coredef.XLEN)
     val mcountinhibit = new CSRPort(coredef.XLEN)
+    val mcounteren = new CSRPort(coredef.XLEN)
+    val scounteren = new CSRPort(coredef.XLEN)
     val mideleg = new CSRPort(coredef.XLEN)
     val medeleg = new CSRPort(coredef.XLEN)
     val pmpaddr0 = new CSRPort(coredef.XLEN)
@@ -157,6 +163,10 @@ class Ctrl(implicit coredef: CoreDef) extends Module {
     val instret = Output(UInt(64.W))
     val cycle = Output(UInt(64.W))
 
+    val mhpmcounter = Vec(PerfEvents.HPM_COUNT, new CSRPort(coredef.XLEN))
+    val mhpmevent = Vec(PerfEvents.HPM_COUNT, new CSRPort(coredef.XLEN))
+    val hpmcounter = Output(Vec(PerfEvents.HPM_COUNT, UInt(64.W)))
+
     val fflags = new CSRPort(coredef.XLEN)
     val frm = new CSRPort(coredef.XLEN)
     val fcsr = new CSRPort(coredef.XLEN)
@@ -254,23 +264,64 @@ class Ctrl(implicit coredef: CoreDef) extends Module {
 
   val mcycle = RegInit(0.U(coredef.XLEN.W))
   val minstret = RegInit(0.U(coredef.XLEN.W))
-  val mcountinhibit = RegInit(0.U(coredef.XLEN.W))
+  val mcountinhibit = RegInit(0.U(32.W))
 
   when(!mcountinhibit(0)) {
     mcycle := mcycle + 1.U
   }
 
-  when(!mcountinhibit(1)) {
+  when(!mcountinhibit(2)) {
     minstret := minstret + toExec.retCnt
   }
 
   csr.mcycle <> CSRPort.fromReg(coredef.XLEN, mcycle)
   csr.minstret <> CSRPort.fromReg(coredef.XLEN, minstret)
-  csr.mcountinhibit <> CSRPort.fromReg(coredef.XLEN, mcountinhibit)
+  csr.mcountinhibit.rdata := mcountinhibit
+  when(csr.mcountinhibit.write) {
+    // time is not implemented, its bit is read-only zero
+    mcountinhibit := csr.mcountinhibit.wdata(31, 0) & ~2.U(32.W)
+  }
 
   csr.instret := minstret
   csr.cycle := mcycle
 
+  // allow cycle, time and instret to be read from S/U-mode
+  // validated by OpenSBI since v1.6 to enable time csr emulation
+  val mcounteren = RegInit(7.U(32.W))
+  val scounteren = RegInit(0.U(32.W))
+  csr.mcounteren <> CSRPort.fromReg(coredef.XLEN, mcounteren)
+  csr.scounteren <> CSRPort.fromReg(coredef.XLEN, scounteren)
+  toExec.counteren.mcounteren := mcounteren
+  toExec.counteren.scounteren := scounteren
+
+  // hpm counters, index i is mhpmcounter{i + 3}
+  // event 0 counts nothing
+  val events = VecInit((0.U +: perf.asSeq).map(_.pad(perf.topDown.width)))
+  val mhpmevent = RegInit(
+    VecInit(
+      Seq.tabulate(PerfEvents.HPM_COUNT)(i =>
+        if (i < TopDownEvents.COUNT) { (i + 1).U(coredef.XLEN.W) }
+        else { 0.U(coredef.XLEN.W) }
+      )
+    )
+  )
+  val mhpmcounter = RegInit(
+    VecInit(Seq.fill(PerfEvents.HPM_COUNT)(0.U(coredef.XLEN.W)))
+  )
+  for (i <- 0 until PerfEvents.HPM_COUNT) {
+    val event = Mux(
+      mhpmevent(i) < events.length.U,
+      events(mhpmevent(i)(log2Ceil(events.length) - 1, 0)),
+      0.U
+    )
+    when(!mcountinhibit(i + 3)) {
+      mhpmcounter(i) := mhpmcounter(i) + event
+    }
+    csr.mhpmcounter(i) <> CSRPort.fromReg(coredef.XLEN, mhpmcounter(i))
+    csr.mhpmevent(i) <> CSRPort.fromReg(coredef.XLEN, mhpmevent(i))
+    csr.hpmcounter(i) := mhpmcounter(i)
+  }
+
   // xstatus
   val status = RegInit(Status.empty)
   // WPRI fields
@@ -500,6 +500,11 @@ abstract class CoreDef {
 
   val IN_ROCKET_SYSTEM: Boolean = false
 
+  /** Export retired instructions and keep writeback values in the ROB, for
+    * co-simulation and retire traces in verilator, off for FPGA
+    */
+  val RETIRE_TRACE: Boolean = false
+
   object L1I
       extends {
         val ADDR_WIDTH: Int = outer.PADDR_WIDTH
@@ -537,12 +542,14 @@ object CoreDef {
   def default(
       initVec: BigInt,
       cacheLineBytes: Int,
-      inRocketSystem: Boolean = false
+      inRocketSystem: Boolean = false,
+      retireTrace: Boolean = false
   ) = {
     new CoreDef {
       override val INIT_VEC = initVec
       override val L1_LINE_BYTES: Int = cacheLineBytes
       override val IN_ROCKET_SYSTEM: Boolean = inRocketSystem
+      override val RETIRE_TRACE: Boolean = retireTrace
     }
   }
 }
@@ -6,6 +6,7 @@ import chisel3.util._
 import chisel3.util.log2Ceil
 import meowv64.core.CSRWriter
 import meowv64.core.CoreDef
+import meowv64.core.CounterEn
 import meowv64.core.ExReq
 import meowv64.core.ExType
 import meowv64.core.PrivLevel
@@ -583,6 +584,10 @@ trait WithStatus {
   val status: Status
 }
 
+trait WithCounterEn {
+  val counteren: CounterEn
+}
+
 class FloatToMemReq(implicit val coredef: CoreDef) extends Bundle {
   val data = UInt(coredef.XLEN.W)
   val lsqIdx = UInt(log2Ceil(coredef.LSQ_DEPTH).W)
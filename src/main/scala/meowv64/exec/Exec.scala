@@ -8,11 +8,14 @@ import meowv64.cache.DCFenceStatus
 import meowv64.cache.L1UCPort
 import meowv64.core.CSRWriter
 import meowv64.core.CoreDef
+import meowv64.core.CounterEn
 import meowv64.core.ExReq
 import meowv64.core.PrivLevel
+import meowv64.core.RetireTrace
 import meowv64.core.Satp
 import meowv64.core.StageCtrl
 import meowv64.core.Status
+import meowv64.core.TopDownEvents
 import meowv64.core.VState
 import meowv64.exec.units._
 import meowv64.instr._
@@ -60,6 +63,8 @@ class Exec(implicit val coredef: CoreDef) extends Module {
     /** Update vState
       */
     val updateVState = Valid(new VState())
+
+    val counteren = Input(new CounterEn)
   })
 
   val toBPU = IO(new Bundle {
@@ -84,6 +89,24 @@ class Exec(implicit val coredef: CoreDef) extends Module {
     val issueNumBoundedByLSQSize = Output(Bool())
     val retireNum = Output(UInt(log2Ceil(coredef.ISSUE_NUM + 1).W))
     val retirePc = Output(UInt(coredef.XLEN.W))
+    val retireTrace =
+      if (coredef.RETIRE_TRACE)
+        Some(Output(Vec(coredef.RETIRE_NUM, new RetireTrace)))
+      else None
+
+    // top-down accounting
+    val fetchICacheMiss = Input(Bool())
+    val fetchRedirect = Input(Bool())
+    val topDown = Output(new TopDownEvents)
+
+    // hpm events
+    val dtlbMiss = Output(Bool())
+    val branchMispredict = Output(Bool())
+    val jalrMispredict = Output(Bool())
+    val robFull = Output(Bool())
+    val lsqFull = Output(Bool())
+    val vectorRetired = Output(UInt(log2Ceil(coredef.RETIRE_NUM + 1).W))
+    val buffetsStall = Output(Bool())
   })
 
   val toBuffets = IO(new Bundle {
@@ -349,6 +372,9 @@ class Exec(implicit val coredef: CoreDef) extends Module {
     if (unit.extras.contains("status")) {
       unit.extras("status") := toCtrl.status
     }
+    if (unit.extras.contains("counteren")) {
+      unit.extras("counteren") := toCtrl.counteren
+    }
     if (unit.extras.contains("floatToMem")) {
       unit.extras("floatToMem") <> lsu.toFloat
     }
@@ -421,6 +447,10 @@ class Exec(implicit val coredef: CoreDef) extends Module {
   toCore.issueNumBoundedByROBSize := issueNum === maxIssueNum
   toCore.issueNumBoundedByLSQSize := issueNum === lsu.toExec.lsqEmptyEntries
   toCore.retireNum := retireNum
+  toCore.robFull := maxIssueNum === 0.U
+  toCore.lsqFull := lsu.toExec.lsqEmptyEntries === 0.U
+  toCore.dtlbMiss := lsu.perf.dtlbMiss
+  toCore.buffetsStall := lsu.perf.buffetsStall
   val retirePc = RegInit(0.U(coredef.XLEN.W))
   for (i <- 0 until coredef.ISSUE_NUM) {
     when(inflights.reader.cnt > i.U) {
@@ -635,6 +665,7 @@ class Exec(implicit val coredef: CoreDef) extends Module {
 
       rob(u.retire.bits.robIndex).valid := true.B
       val info = u.retire.bits.info
+      rob(u.retire.bits.robIndex).wb.foreach(_ := info.wb(coredef.XLEN - 1, 0))
       // for BRANCH instructions, this means taken before normalization
       rob(u.retire.bits.robIndex).branchTaken := info.branchTaken
 
@@ -688,6 +719,10 @@ class Exec(implicit val coredef: CoreDef) extends Module {
   }
   toCtrl.stepAck := false.B
 
+  // redirects by retiring branches, for hpm
+  toCore.branchMispredict := false.B
+  toCore.jalrMispredict := false.B
+
   val retireNext = rob(retirePtr)
 
   when(!retireNext.valid) {
@@ -807,6 +842,20 @@ class Exec(implicit val coredef: CoreDef) extends Module {
           toCtrl.nepc := inflight.addr
         }
 
+        when(
+          pendingBr && pendingBrTag === tag && pendingBrResult.valid &&
+            pendingBrResult.ex === ExReq.none
+        ) {
+          when(inflight.op === Decoder.Op("JALR").ident) {
+            toCore.jalrMispredict := true.B
+          }.elsewhen(
+            inflight.op === Decoder.Op("BRANCH").ident ||
+              inflight.op === Decoder.Op("JAL").ident
+          ) {
+            toCore.branchMispredict := true.B
+          }
+        }
+
         info.clear()
       }.otherwise {}
     }
@@ -833,6 +882,104 @@ class Exec(implicit val coredef: CoreDef) extends Module {
       !rob(retirePtr +% i.U).exceptionOccurred
   }
 
+  // retire trace
+  if (coredef.RETIRE_TRACE) {
+    val lsuStore = lsu.storeTrace.get
+    for (i <- (0 until coredef.RETIRE_NUM)) {
+      val inflight = inflights.reader.view(i)
+      val tag = retirePtr +% i.U
+      val retiring = i.U < retireNum
+      val trace = toCore.retireTrace.get(i)
+      trace.valid := retiring && !rob(tag).exceptionOccurred
+      trace.pc := inflight.addr
+      trace.instr := inflight.instr
+      trace.wen := inflight.writeRdEff && (
+        inflight.rdIndex.ty === RegType.float ||
+          (inflight.rdIndex.ty === RegType.integer &&
+            inflight.rdIndex.index =/= 0.U)
+      )
+      trace.rdFloat := inflight.rdIndex.ty === RegType.float
+      trace.rd := inflight.rdIndex.index
+      trace.wdata := rob(tag).wb.get
+      // delayed memory ops write back in the same cycle as they retire
+      when(lsu.retire.fire && lsu.retire.bits.robIndex === tag) {
+        trace.wdata := lsu.retire.bits.info.wb(coredef.XLEN - 1, 0)
+      }
+      // store is sent to L1 when it retires, attach it to its own slot
+      val store = lsuStore.valid && lsuStore.bits.robIndex === tag && retiring
+      trace.store := store
+      trace.storeAddr := Mux(store, lsuStore.bits.addr, 0.U)
+      trace.storeData := Mux(store, lsuStore.bits.data, 0.U)
+      trace.storeBe := Mux(store, lsuStore.bits.be, 0.U)
+    }
+  }
+
+  // retired vector instructions, including vector loads and stores
+  toCore.vectorRetired := PopCount((0 until coredef.RETIRE_NUM).map { i =>
+    val inflight = inflights.reader.view(i)
+    val width = inflight.instr(14, 12)
+    val isVectorMem = (inflight.op === Decoder.Op("LOAD-FP").ident ||
+      inflight.op === Decoder.Op("STORE-FP").ident) &&
+      (width === 0.U || width >= 5.U)
+    i.U < retireNum && (inflight.op === Decoder.Op("OP-V").ident ||
+      isVectorMem)
+  })
+
+  // top-down accounting of issue slots
+  // empty slots after a flush are bad speculation until the frontend refills
+  val recovering = RegInit(false.B)
+  when(toCtrl.ctrl.flush) {
+    recovering := true.B
+  }.elsewhen(toIF.cnt =/= 0.U) {
+    recovering := false.B
+  }
+  val fetchedSlots = Mux(
+    toIF.cnt > coredef.ISSUE_NUM.U,
+    coredef.ISSUE_NUM.U,
+    toIF.cnt
+  )
+  val emptySlots = coredef.ISSUE_NUM.U -& fetchedSlots
+  val blockedSlots = fetchedSlots -& issueNum
+  // oldest instruction is a memory op waiting for L1DC, uncached or Buffets
+  val headOp = inflights.reader.view(0).op
+  val headIsMem = headOp === Decoder.Op("LOAD").ident ||
+    headOp === Decoder.Op("STORE").ident ||
+    headOp === Decoder.Op("LOAD-FP").ident ||
+    headOp === Decoder.Op("STORE-FP").ident ||
+    headOp === Decoder.Op("AMO").ident
+  val memoryBound = (inflights.reader.cnt =/= 0.U && headIsMem &&
+    retireNum === 0.U) || lsu.toExec.lsqAllocAccept === 0.U
+
+  val topDown = toCore.topDown
+  topDown.frontendBound := 0.U
+  topDown.badSpeculation := 0.U
+  topDown.backendMemoryBound := 0.U
+  topDown.backendCoreBound := 0.U
+  topDown.retiring := retireNum
+  topDown.frontendICacheMiss := 0.U
+  topDown.frontendRedirect := 0.U
+  when(toCtrl.ctrl.flush) {
+    // issued and in-flight instructions are discarded
+    topDown.badSpeculation := coredef.ISSUE_NUM.U +& inflights.reader.cnt -
+      retireNum
+  }.otherwise {
+    when(recovering) {
+      topDown.badSpeculation := emptySlots
+    }.otherwise {
+      topDown.frontendBound := emptySlots
+      when(toCore.fetchICacheMiss) {
+        topDown.frontendICacheMiss := emptySlots
+      }.elsewhen(toCore.fetchRedirect) {
+        topDown.frontendRedirect := emptySlots
+      }
+    }
+    when(memoryBound) {
+      topDown.backendMemoryBound := blockedSlots
+    }.otherwise {
+      topDown.backendCoreBound := blockedSlots
+    }
+  }
+
   renamer.toExec.retire := retireNum
   inflights.reader.accept := retireNum
   assert(inflights.reader.cnt >= retireNum)
@@ -894,6 +1041,10 @@ class ROBEntry(implicit val coredef: CoreDef) extends Bundle {
     */
   val exceptionOccurred = Bool()
 
+  /** Writeback value, for retire trace
+    */
+  val wb = if (coredef.RETIRE_TRACE) Some(UInt(coredef.XLEN.W)) else None
+
   def clear() = {
     this.valid := false.B
     this.hasMem := false.B
@@ -916,6 +1067,7 @@ object ROBEntry {
     ret.fflags := 0.U
     ret.vState := 0.U.asTypeOf(new VState)
     ret.exceptionOccurred := false.B
+    ret.wb.foreach(_ := 0.U)
 
     ret
   }
@@ -7,6 +7,7 @@ import chisel3.util.Valid
 import chisel3.util.log2Ceil
 import meowv64.core.CSRWriter
 import meowv64.core.CoreDef
+import meowv64.core.CounterEn
 import meowv64.core.PortInfo
 import meowv64.core.PrivLevel
 import meowv64.core.RegInfo
@@ -109,6 +110,21 @@ class UnitSel(
       u.asInstanceOf[WithStatus].status := status
     }
 
+    if (u.isInstanceOf[WithCounterEn]) {
+      println("Found extra port: counteren")
+
+      val counteren = extras.get("counteren") match {
+        case Some(port) => port
+        case None => {
+          val counteren = IO(Input(new CounterEn))
+          extras.put("counteren", counteren)
+          counteren
+        }
+      }
+
+      u.asInstanceOf[WithCounterEn].counteren := counteren
+    }
+
     if (u.isInstanceOf[WithFloatToMem]) {
       println("Found extra port: floatToMem")
 
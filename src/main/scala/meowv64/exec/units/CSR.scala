@@ -19,6 +19,7 @@ class CSR(implicit val coredef: CoreDef)
     with WithCSRWriter
     with WithPrivPort
     with WithStatus
+    with WithCounterEn
     with WithVState {
   val DEPTH: Int = 0
 
@@ -30,6 +31,7 @@ class CSR(implicit val coredef: CoreDef)
   val io = IO(new ExecUnitPort(regInfo))
   val priv = IO(Input(PrivLevel()))
   val status = IO(Input(new Status))
+  val counteren = IO(Input(new CounterEn))
   val writer = IO(new CSRWriter())
   val vState = IO(Input(new VState()))
 
@@ -104,6 +106,14 @@ class CSR(implicit val coredef: CoreDef)
   val ro = addr(11, 10) === 3.U
   val minPriv = addr(9, 8).asTypeOf(PrivLevel())
 
+  // cycle, time, instret and hpmcounters are gated by xcounteren
+  val isCounter = addr(11, 5) === (0xc00 >> 5).U
+  val counterIdx = addr(4, 0)
+  val counterDenied = isCounter && (
+    (priv < PrivLevel.M && !counteren.mcounteren(counterIdx)) ||
+      (priv === PrivLevel.U && !counteren.scounteren(counterIdx))
+  )
+
   val wdata = RegInit(0.U(coredef.XLEN.W))
   val wdiff = Wire(UInt(coredef.XLEN.W))
   wdiff := DontCare
@@ -155,7 +165,7 @@ class CSR(implicit val coredef: CoreDef)
   when(isVSETVL) {
     fault := false.B
     rdata := newVState.vl
-  }.elsewhen((ro && written) || priv < minPriv) {
+  }.elsewhen((ro && written) || priv < minPriv || counterDenied) {
     fault := true.B
     rdata := DontCare
   }.elsewhen((addr === 0x180.U) && status.tvm) { // SATP trap
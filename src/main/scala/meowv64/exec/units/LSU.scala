@@ -320,6 +320,25 @@ class LSU(implicit val coredef: CoreDef) extends Module with UnitSelIO {
 
   val release = IO(EnqIO(new Bundle {}))
 
+  // hpm events
+  val perf = IO(Output(new Bundle {
+    val dtlbMiss = Bool()
+    val buffetsStall = Bool()
+  }))
+  perf.dtlbMiss := tlb.miss
+  perf.buffetsStall := false.B
+
+  // scalar store sent to L1, for retire trace
+  val storeTrace =
+    if (coredef.RETIRE_TRACE)
+      Some(IO(Output(Valid(new Bundle {
+        val robIndex = UInt(log2Ceil(coredef.INFLIGHT_INSTR_LIMIT).W)
+        val addr = UInt(coredef.XLEN.W)
+        val data = UInt(coredef.XLEN.W)
+        val be = UInt((coredef.XLEN / 8).W)
+      }))))
+    else None
+
   // check: release ready should be stable until valid
   when(RegNext(release.ready && ~release.valid)) {
     assert(release.ready)
@@ -686,6 +705,14 @@ class LSU(implicit val coredef: CoreDef) extends Module with UnitSelIO {
   release.valid := false.B
   toBuffets.head.ready := false.B
 
+  storeTrace.foreach { t =>
+    t.valid := false.B
+    t.bits.robIndex := current.robIndex
+    t.bits.addr := current.addr
+    t.bits.data := current.data(coredef.XLEN - 1, 0)
+    t.bits.be := DCWriteLen.toByteEnable(current.len)
+  }
+
   // compute write back value from reader
   val shifted =
     toMem.reader.resp.bits >>
@@ -916,6 +943,7 @@ class LSU(implicit val coredef: CoreDef) extends Module with UnitSelIO {
             advance := true.B
             toBuffets.head.ready := true.B
           }
+          perf.buffetsStall := release.ready && !toBuffets.head.valid
         }.otherwise {
           when(current.op === DelayedMemOp.uncachedLoad) {
             retire.bits.info.wb := current.getLSB(toMem.uncached.rdata)
@@ -960,6 +988,7 @@ class LSU(implicit val coredef: CoreDef) extends Module with UnitSelIO {
               retire.valid := true.B
               retire.bits.info.wb := toMem.writer.rdata
             }
+            storeTrace.foreach(_.valid := current.wop === DCWriteOp.write)
 
             release.valid := true.B
             advance := true.B
@@ -119,6 +119,14 @@ class InstrFetch(implicit val coredef: CoreDef) extends Module {
 
   val debug = IO(new Bundle {
     val pc = Output(UInt(coredef.XLEN.W))
+
+    // for top-down accounting
+    // waiting for I$ or ITLB
+    val icacheMiss = Output(Bool())
+    // fetching the target of a taken branch predicted by BPU
+    val redirect = Output(Bool())
+    // for hpm
+    val itlbMiss = Output(Bool())
   })
 
   val toCore = IO(new Bundle {
@@ -175,6 +183,8 @@ class InstrFetch(implicit val coredef: CoreDef) extends Module {
     assert(icInflight)
     icInflight := false.B
   }
+  debug.icacheMiss := readStalled || (icInflight && !toIC.data.valid)
+  debug.redirect := !s1PipeSuccessive || !s2Successive
 
   // handle page fault
   // corner case:
@@ -230,6 +240,7 @@ class InstrFetch(implicit val coredef: CoreDef) extends Module {
 
   tlb.ptw <> toCore.ptw
   tlb.satp := toCore.satp
+  debug.itlbMiss := tlb.miss
   tlb.query.req.bits.vpn := s1FPc(47, 12)
   tlb.query.req.valid := requiresTranslate && !toCtrl.ctrl.flush
   tlb.query.req.bits.access := TLBAccessMode.X
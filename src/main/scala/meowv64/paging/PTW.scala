@@ -20,6 +20,10 @@ class PTW(implicit coredef: CoreDef) extends Module {
 
   val satp = IO(Input(new Satp))
   val dc = IO(new CoreDCReader)
+
+  // page table walk started, for hpm
+  val walk = IO(Output(Bool()))
+  walk := false.B
   dc.req.noenq()
   dc.req.bits.addr := 0.U
   dc.req.bits.reserve := false.B
@@ -101,6 +105,7 @@ class PTW(implicit coredef: CoreDef) extends Module {
           CoreDCReadReq.load(satp.ppn ## initSeg ## 0.U(3.W))
         ) // PTE are aligned in 64-bits
         when(dc.req.fire) {
+          walk := true.B
           state := PTWState.reading
         }
       }
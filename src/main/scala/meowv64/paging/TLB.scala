@@ -44,6 +44,10 @@ class TLB(implicit val coredef: CoreDef) extends Module {
 
   val flush = IO(Input(Bool()))
 
+  // refill started, for hpm
+  val miss = IO(Output(Bool()))
+  miss := false.B
+
   object TLBState extends ChiselEnum {
     val idle, req, resp = Value
   }
@@ -109,6 +113,7 @@ class TLB(implicit val coredef: CoreDef) extends Module {
         query.req.ready := inStore || fault
 
         when(!query.req.ready) {
+          miss := true.B
           refilling := query.req.bits.vpn
           state := TLBState.req
           ptwFaulted := false.B
@@ -9,11 +9,15 @@ import meowv64.system.SystemDef
 
 /** Create multiple copies of a MeowV64 tile (and thus a core). Override with
   * the default mixins to control all params of the tiles.
+  *
+  * retireTrace exports retired instructions for verilator co-simulation and
+  * retire traces, keep it off for FPGA.
   */
 class WithMeowV64Cores(
     systemDef: SystemDef = new SingleCoreSystemDef,
     overrideIdOffset: Option[Int] = None,
-    initVec: Option[BigInt] = None
+    initVec: Option[BigInt] = None,
+    retireTrace: Boolean = false
 ) extends Config((_, _, up) => {
       // Set to line bytes
       case CacheBlockBytes => systemDef.L2_LINE_BYTES
@@ -32,7 +36,8 @@ class WithMeowV64Cores(
                 .default(
                   initVec = initVec.getOrElse(systemDef.INIT_VEC),
                   cacheLineBytes = systemDef.L2_LINE_BYTES,
-                  inRocketSystem = true
+                  inRocketSystem = true,
+                  retireTrace = retireTrace
                 ),
               tileId = i + idOffset
             ),
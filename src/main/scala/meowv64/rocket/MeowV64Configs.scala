@@ -18,6 +18,8 @@ import freechips.rocketchip.subsystem.MasterPortParams
 import freechips.rocketchip.subsystem.MemoryBusKey
 import _root_.freechips.rocketchip.subsystem.WithDefaultSlavePort
 import freechips.rocketchip.subsystem.WithNExtTopInterrupts
+import freechips.rocketchip.devices.debug.DMI
+import freechips.rocketchip.devices.debug.ExportDebug
 
 class WithCustomMemPort
     extends Config((site, _, _) => { case CustomExtMem =>
@@ -52,6 +54,13 @@ class WithCustomMMIOPort
       )
     })
 
+// DMI port for the gdbserver of the verilator harness in place of JTAG
+class WithHarnessDMI
+    extends Config((_, _, up) => {
+      case HarnessDMI  => true
+      case ExportDebug => up(ExportDebug).copy(protocols = Set(DMI))
+    })
+
 class MeowV64BaseConfig
     extends Config(
       new WithCustomMemPort ++
@@ -68,10 +77,17 @@ class MeowV64BaseConfig
 
 class MeowV64SingleCoreConfig
     extends Config(
-      new WithMeowV64Cores(new SingleCoreSystemDef) ++
+      new WithMeowV64Cores(new SingleCoreSystemDef, retireTrace = true) ++
         new MeowV64BaseConfig
     )
 
+// SingleCoreConfig with the DMI port for --gdb of the verilator harness
+class MeowV64SingleCoreGdbConfig
+    extends Config(
+      new WithHarnessDMI ++
+        new MeowV64SingleCoreConfig
+    )
+
 class MeowV64FPGAConfig
     extends Config(
       new WithMeowV64Cores(
@@ -84,19 +100,19 @@ class MeowV64FPGAConfig
 
 class MeowV64DualCoreConfig
     extends Config(
-      new WithMeowV64Cores(new DualCoreSystemDef) ++
+      new WithMeowV64Cores(new DualCoreSystemDef, retireTrace = true) ++
         new MeowV64BaseConfig
     )
 
 class MeowV64HexaCoreConfig
     extends Config(
-      new WithMeowV64Cores(new HexaCoreSystemDef) ++
+      new WithMeowV64Cores(new HexaCoreSystemDef, retireTrace = true) ++
         new MeowV64BaseConfig
     )
 
 class MeowV64DecaCoreConfig
     extends Config(
-      new WithMeowV64Cores(new DecaCoreSystemDef) ++
+      new WithMeowV64Cores(new DecaCoreSystemDef, retireTrace = true) ++
         new MeowV64BaseConfig
     )
 
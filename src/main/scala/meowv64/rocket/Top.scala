@@ -5,6 +5,7 @@ import org.chipsalliance.cde.config.Parameters
 import chisel3._
 import chisel3.experimental.dataview._
 import freechips.rocketchip.devices.debug.Debug
+import freechips.rocketchip.devices.debug.DMIIO
 import freechips.rocketchip.devices.tilelink.BootROM
 import freechips.rocketchip.devices.tilelink.BootROMLocated
 import org.chipsalliance.diplomacy.bundlebridge.BundleBridgeNexusNode
@@ -71,23 +72,35 @@ class RiscVSystem(implicit val p: Parameters) extends Module {
     .getOrElse(false.B)).asBool
   top.io_clocks.get.elements.values.foreach(_.reset := childReset)
 
-  // setup jtag
-  val systemJtag = top.debug.get.systemjtag.get
-  systemJtag.jtag.TCK := jtag.TCK
-  systemJtag.jtag.TMS := jtag.TMS
-  systemJtag.jtag.TDI := jtag.TDI
-  jtag.TDO := systemJtag.jtag.TDO
-  //systemJtag.mfr_id := p(JtagDTMKey).idcodeManufId.U(11.W)
-  //systemJtag.part_number := p(JtagDTMKey).idcodePartNum.U(16.W)
-  //systemJtag.version := p(JtagDTMKey).idcodeVersion.U(4.W)
-  // custom idcode
-  systemJtag.mfr_id := 0.U
-  systemJtag.part_number := 0x2222.U
-  systemJtag.version := 1.U
-  // MUST use async reset here
-  // otherwise the internal logic(e.g. TLXbar) might not function
-  // if reset deasserted before TCK rises
-  systemJtag.reset := reset.asAsyncReset
+  if (p(HarnessDMI)) {
+    // debug module exports dmi to the gdbserver of the verilator harness,
+    // clocked like SimDTM of rocket-chip, there is no jtag dtm in this build
+    val dmi = IO(Flipped(new DMIIO()))
+    val clockedDMI = top.debug.get.clockeddmi.get
+    clockedDMI.dmi <> dmi
+    clockedDMI.dmiClock := clock
+    clockedDMI.dmiReset := reset
+    jtag.TDO.data := false.B
+    jtag.TDO.driven := false.B
+  } else {
+    // setup jtag
+    val systemJtag = top.debug.get.systemjtag.get
+    systemJtag.jtag.TCK := jtag.TCK
+    systemJtag.jtag.TMS := jtag.TMS
+    systemJtag.jtag.TDI := jtag.TDI
+    jtag.TDO := systemJtag.jtag.TDO
+    //systemJtag.mfr_id := p(JtagDTMKey).idcodeManufId.U(11.W)
+    //systemJtag.part_number := p(JtagDTMKey).idcodePartNum.U(16.W)
+    //systemJtag.version := p(JtagDTMKey).idcodeVersion.U(4.W)
+    // custom idcode
+    systemJtag.mfr_id := 0.U
+    systemJtag.part_number := 0x2222.U
+    systemJtag.version := 1.U
+    // MUST use async reset here
+    // otherwise the internal logic(e.g. TLXbar) might not function
+    // if reset deasserted before TCK rises
+    systemJtag.reset := reset.asAsyncReset
+  }
   top.resetctrl.foreach { rc =>
     rc.hartIsInReset.foreach { _ := childReset }
   }
@@ -236,6 +249,9 @@ trait CanHaveCustomMasterAXI4MMIOPort { this: BaseSubsystem =>
 // Flip MSB of MEM/MMIO axi4 ports
 case object FlipMSBInAXI extends config.Field[Boolean](false)
 
+// Expose DMI of the debug module to the verilator harness instead of JTAG
+case object HarnessDMI extends config.Field[Boolean](false)
+
 // Size of Buffets per Core
 case object BuffetsSizePerCore extends config.Field[BigInt](0x4000L)
 
@@ -78,12 +78,64 @@ float fabsf(float num) {
     return -num;
 }
 
+#ifdef FAST_CONSOLE
+// console of the verilator harness, which only sees memory behind the
+// caches and there is no cache writeback instruction, so characters are
+// packed into 64-bit words that go straight to the uncached staging buffer
+// as each word fills, then one store of (length << 48 | address) prints the
+// line in place
+// each hart has 256 bytes of the 4 KiB staging buffer
+#define CONSOLE_MAX_HARTS 16
+#define CONSOLE_LINE_WORDS 32
+volatile uint64_t *CONSOLE = (uint64_t *)0x60002000;
+volatile uint64_t *CONSOLE_BUFFER = (uint64_t *)0x60003000;
+static uint64_t console_word[CONSOLE_MAX_HARTS];
+static int console_len[CONSOLE_MAX_HARTS];
+
+static inline void console_flush(int hart) {
+  volatile uint64_t *buffer = CONSOLE_BUFFER + hart * CONSOLE_LINE_WORDS;
+  int len = console_len[hart];
+  if (len % 8) {
+    buffer[len / 8] = console_word[hart];
+  }
+  *CONSOLE = ((uint64_t)len << 48) | (uintptr_t)buffer;
+  console_word[hart] = 0;
+  console_len[hart] = 0;
+}
+
+static inline void _putchar(char c) {
+  int hart = read_csr(mhartid);
+  int len = console_len[hart];
+  console_word[hart] |= (uint64_t)(unsigned char)c << (len % 8 * 8);
+  console_len[hart] = ++len;
+  if (len % 8 == 0) {
+    CONSOLE_BUFFER[hart * CONSOLE_LINE_WORDS + len / 8 - 1] =
+        console_word[hart];
+    console_word[hart] = 0;
+  }
+  if (c == '\n' || len >= CONSOLE_LINE_WORDS * 8) {
+    console_flush(hart);
+  }
+}
+
+// called by init.S when main returns, other harts are parked by then
+void console_exit() {
+  for (int hart = 0; hart < CONSOLE_MAX_HARTS; hart++) {
+    if (console_len[hart]) {
+      console_flush(hart);
+    }
+  }
+}
+#else
 static inline void _putchar(char c) {
   while (!(*UART_LSR & 0x40))
     ;
   *UART_THR = c;
 }
 
+void console_exit() {}
+#endif
+
 static inline void _puts(char *s) {
   while (*s) {
     _putchar(*s++);
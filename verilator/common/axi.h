@@ -0,0 +1,77 @@
+#ifndef __AXI_H__
+#define __AXI_H__
+
+#include "memory.h"
+#include <stdint.h>
+#include <string.h>
+
+// expand 8 strobe bits to a 64-bit byte mask
+static inline uint64_t expand_strb(uint64_t strb) {
+  uint64_t x = strb & 0xFF;
+  x = (x | (x << 28)) & 0x0000000F0000000FL;
+  x = (x | (x << 14)) & 0x0003000300030003L;
+  x = (x | (x << 7)) & 0x0101010101010101L;
+  return x * 0xFF;
+}
+
+// one data beat on an AXI bus of DATA_WIDTH bits
+// stored as 64-bit little endian lanes, no heap allocation
+template <uint64_t DATA_WIDTH> struct axi_beat {
+  static const uint64_t DATA_BYTES = DATA_WIDTH / 8;
+  static const uint64_t LANES = DATA_BYTES / sizeof(uint64_t);
+  static_assert(DATA_WIDTH >= 64 && DATA_WIDTH <= 512 &&
+                    (DATA_WIDTH & (DATA_WIDTH - 1)) == 0,
+                "unsupported axi data width");
+
+  uint64_t data[LANES];
+
+  // byte lanes covered by a narrow transfer of (1 << size) bytes at addr
+  static uint64_t size_strb(uint64_t addr, uint64_t size) {
+    uint64_t bytes = 1L << size;
+    uint64_t mask = bytes >= 64 ? ~0L : (1L << bytes) - 1;
+    return mask << (addr & (DATA_BYTES - 1));
+  }
+
+  static uint64_t aligned(uint64_t addr) {
+    return addr & ~(DATA_BYTES - 1);
+  }
+
+  // read the beat containing addr from memory
+  void load(PagedMemory &memory, uint64_t addr) {
+    // a beat never crosses page boundary
+    uint8_t *page = memory.find_page(aligned(addr));
+    if (page) {
+      memcpy(data, &page[aligned(addr) & (PagedMemory::PAGE_SIZE - 1)],
+             DATA_BYTES);
+    } else {
+      memset(data, 0, DATA_BYTES);
+    }
+  }
+
+  // merge strobed bytes of the beat into memory
+  void store(PagedMemory &memory, uint64_t addr, uint64_t strb) {
+    if (!strb) {
+      return;
+    }
+    uint8_t *page = memory.get_page(aligned(addr));
+    uint64_t *dst =
+        (uint64_t *)&page[aligned(addr) & (PagedMemory::PAGE_SIZE - 1)];
+    for (uint64_t i = 0; i < LANES; i++) {
+      uint64_t mask = expand_strb(strb >> (i * 8));
+      dst[i] = (dst[i] & ~mask) | (data[i] & mask);
+    }
+  }
+
+  // clear bytes outside strb
+  void mask(uint64_t strb) {
+    for (uint64_t i = 0; i < LANES; i++) {
+      data[i] &= expand_strb(strb >> (i * 8));
+    }
+  }
+
+  // convert from/to verilated signals
+  void from_signal(const void *signal) { memcpy(data, signal, DATA_BYTES); }
+  void to_signal(void *signal) const { memcpy(signal, data, DATA_BYTES); }
+};
+
+#endif
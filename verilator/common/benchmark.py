@@ -0,0 +1,247 @@
+#!/usr/bin/env python3
+# run benchmarks listed in a manifest in parallel, collect --stats-json of
+# each run into one table and compare against a baseline
+#
+# manifest is json, paths are relative to the manifest:
+#   {"jobs": [{"name": "dhrystone",
+#              "config": "SingleCoreConfig",
+#              "binary": "../../testcases/.../dhrystone.riscv",
+#              "dramsim": "DDR4_8Gb_x8_8b_3200.ini",  # optional, -D
+#              "args": ["-l", "20"],                  # optional
+#              "threads": 4,                          # optional
+#              "metrics": {"dhrystones_per_second": {  # optional
+#                  "pattern": "Dhrystones per Second:\\s+(\\d+)",
+#                  "better": "higher"}}}]}
+#
+# config is a directory under verilator/ with a built VRiscVSystem, threads
+# defaults to VERILATOR_THREADS of that config, plus one with --dram-thread.
+# jobs are started while the sum of their threads fits in the host cores (-j)
+#
+# baseline is json of {name: {metric: value}}, cycles and minstret are
+# lower-is-better, ipc is higher-is-better
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import time
+
+VERILATOR_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+DEFAULT_THREADS = 4
+
+# metric -> True if higher is better
+BUILTIN_METRICS = {"cycles": False, "minstret": False, "ipc": True}
+
+
+def config_threads(config):
+    # VERILATOR_THREADS ?= N in config Makefile, else default of Makefrag
+    try:
+        with open(os.path.join(VERILATOR_DIR, config, "Makefile")) as f:
+            for line in f:
+                m = re.match(r"\s*VERILATOR_THREADS\s*\??=\s*(\d+)", line)
+                if m:
+                    return int(m[1])
+    except OSError:
+        pass
+    return DEFAULT_THREADS
+
+
+def load_manifest(path):
+    base = os.path.dirname(os.path.abspath(path))
+    with open(path) as f:
+        manifest = json.load(f)
+    jobs = []
+    for job in manifest["jobs"]:
+        job = dict(job)
+        job["binary"] = os.path.join(base, job["binary"])
+        if job.get("dramsim"):
+            job["dramsim"] = os.path.join(base, job["dramsim"])
+        job.setdefault("args", [])
+        job.setdefault("metrics", {})
+        if "threads" not in job:
+            job["threads"] = config_threads(job["config"])
+            # --dram-thread runs dramsim3 on one more host thread
+            if job.get("dramsim") and "--dram-thread" in job["args"]:
+                job["threads"] += 1
+        jobs.append(job)
+    return jobs
+
+
+def start(job, out_dir):
+    # each job runs in its own directory, dramsim3 and signature output
+    # are written relative to cwd
+    work = os.path.join(out_dir, job["name"])
+    os.makedirs(os.path.join(work, "out"), exist_ok=True)
+    simulator = os.path.join(VERILATOR_DIR, job["config"], "VRiscVSystem")
+    cmd = [simulator, "--stats-json", "stats.json"]
+    if job.get("dramsim"):
+        cmd += ["-D", job["dramsim"]]
+    cmd += job["args"] + [job["binary"]]
+    log = open(os.path.join(work, "log"), "w")
+    log.write(" ".join(cmd) + "\n")
+    log.flush()
+    job["work"] = work
+    job["begin"] = time.time()
+    return subprocess.Popen(cmd, cwd=work, stdout=log,
+                            stderr=subprocess.STDOUT), log
+
+
+def collect(job, returncode):
+    result = {"name": job["name"], "config": job["config"],
+              "returncode": returncode,
+              "wall_time": time.time() - job["begin"]}
+    try:
+        with open(os.path.join(job["work"], "stats.json")) as f:
+            stats = json.load(f)
+        # harness cycles include reset, compare the mcycle of hart 0
+        result["cycles"] = stats["cores"][0]["mcycle"]
+        result["minstret"] = stats["aggregate"]["minstret"]
+        result["ipc"] = stats["aggregate"]["ipc"]
+        result["mcycle_per_second"] = stats["host"]["mcycle_per_second"]
+        result["stats"] = stats
+    except (OSError, ValueError, KeyError):
+        pass
+    with open(os.path.join(job["work"], "log"), errors="replace") as f:
+        log = f.read()
+    for name, metric in job["metrics"].items():
+        m = re.search(metric["pattern"], log)
+        if m:
+            result[name] = float(m[1])
+    return result
+
+
+def run_all(jobs, out_dir, cores):
+    pending = list(jobs)
+    running = []
+    results = []
+    while pending or running:
+        used = sum(job["threads"] for job, _, _ in running)
+        # start in manifest order while threads fit, a job larger than the
+        # host runs alone
+        while pending and (not running or
+                           used + pending[0]["threads"] <= cores):
+            job = pending.pop(0)
+            proc, log = start(job, out_dir)
+            running.append((job, proc, log))
+            used += job["threads"]
+            print("> Started {} ({} threads)".format(job["name"],
+                                                    job["threads"]),
+                  file=sys.stderr)
+        for entry in list(running):
+            job, proc, log = entry
+            if proc.poll() is None:
+                continue
+            log.close()
+            running.remove(entry)
+            result = collect(job, proc.returncode)
+            results.append(result)
+            print("> Finished {} in {:.1f}s, exit code {}".format(
+                job["name"], result["wall_time"], proc.returncode),
+                file=sys.stderr)
+        time.sleep(0.1)
+    # keep manifest order
+    order = {job["name"]: i for i, job in enumerate(jobs)}
+    results.sort(key=lambda result: order[result["name"]])
+    return results
+
+
+def higher_is_better(jobs, name, metric):
+    if metric in BUILTIN_METRICS:
+        return BUILTIN_METRICS[metric]
+    for job in jobs:
+        if job["name"] == name and metric in job["metrics"]:
+            return job["metrics"][metric].get("better", "higher") == "higher"
+    return True
+
+
+def compare(jobs, results, baseline, tolerance):
+    regressions = []
+    for result in results:
+        for metric, old in baseline.get(result["name"], {}).items():
+            if metric not in result or not old:
+                continue
+            new = result[metric]
+            change = (new - old) / old
+            if not higher_is_better(jobs, result["name"], metric):
+                change = -change
+            result.setdefault("change", {})[metric] = change
+            if change < -tolerance:
+                regressions.append((result["name"], metric, old, new))
+    return regressions
+
+
+def print_table(results):
+    print("{:24} {:>4} {:>12} {:>12} {:>6} {:>10} {:>8}".format(
+        "name", "exit", "cycles", "minstret", "ipc", "mcycle/s", "wall"))
+    for result in results:
+        print("{:24} {:>4} {:>12} {:>12} {:>6.2f} {:>10.0f} {:>7.1f}s".format(
+            result["name"], result["returncode"], result.get("cycles", "-"),
+            result.get("minstret", "-"), result.get("ipc", 0),
+            result.get("mcycle_per_second", 0), result["wall_time"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run benchmark manifest")
+    parser.add_argument("manifest")
+    parser.add_argument("-o", "--output", default="benchmark-results",
+                        help="directory for per job logs and results.json")
+    parser.add_argument("-j", "--cores", type=int, default=os.cpu_count(),
+                        help="host cores to fill with simulator threads")
+    parser.add_argument("-b", "--baseline",
+                        help="baseline json to compare against")
+    parser.add_argument("-t", "--tolerance", type=float, default=0.02,
+                        help="relative change flagged as regression")
+    parser.add_argument("-u", "--update-baseline", action="store_true",
+                        help="write results of passing jobs to baseline")
+    parser.add_argument("-f", "--filter",
+                        help="only run jobs whose name matches regex")
+    args = parser.parse_args()
+
+    jobs = load_manifest(args.manifest)
+    if args.filter:
+        jobs = [job for job in jobs if re.search(args.filter, job["name"])]
+    out_dir = os.path.abspath(args.output)
+    os.makedirs(out_dir, exist_ok=True)
+
+    results = run_all(jobs, out_dir, args.cores)
+
+    baseline = {}
+    if args.baseline and os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    regressions = compare(jobs, results, baseline, args.tolerance)
+
+    with open(os.path.join(out_dir, "results.json"), "w") as f:
+        json.dump(results, f, indent=2)
+    print_table(results)
+
+    failed = [result["name"] for result in results if result["returncode"]]
+    for name in failed:
+        print("> {} failed, see {}".format(
+            name, os.path.join(out_dir, name, "log")), file=sys.stderr)
+    for name, metric, old, new in regressions:
+        print("> Regression in {} {}: {} -> {}".format(name, metric, old, new),
+              file=sys.stderr)
+
+    if args.update_baseline and args.baseline:
+        for result in results:
+            if result["returncode"]:
+                continue
+            entry = baseline.setdefault(result["name"], {})
+            for metric in list(BUILTIN_METRICS) + [
+                    metric for job in jobs if job["name"] == result["name"]
+                    for metric in job["metrics"]]:
+                if metric in result:
+                    entry[metric] = result[metric]
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("> Updated baseline {}".format(args.baseline), file=sys.stderr)
+
+    return 1 if failed or regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
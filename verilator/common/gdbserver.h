@@ -0,0 +1,715 @@
+#ifndef __GDBSERVER_H__
+#define __GDBSERVER_H__
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <fcntl.h>
+#include <functional>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// gdb remote serial protocol server talking to the riscv debug module over
+// dmi, without a jtag dtm or openocd in between
+//
+// gprs use abstract commands, fprs and csrs the program buffer, memory the
+// system bus access. all harts stop together, gdb threads are harts
+//
+// the server runs on its own thread, dmi accesses are blocking calls into
+// the simulation thread
+
+// dmi registers
+const uint32_t DMI_DATA0 = 0x04;
+const uint32_t DMI_DATA1 = 0x05;
+const uint32_t DMI_DMCONTROL = 0x10;
+const uint32_t DMI_DMSTATUS = 0x11;
+const uint32_t DMI_ABSTRACTCS = 0x16;
+const uint32_t DMI_COMMAND = 0x17;
+const uint32_t DMI_PROGBUF0 = 0x20;
+const uint32_t DMI_PROGBUF1 = 0x21;
+const uint32_t DMI_SBCS = 0x38;
+const uint32_t DMI_SBADDRESS0 = 0x39;
+const uint32_t DMI_SBADDRESS1 = 0x3a;
+const uint32_t DMI_SBDATA0 = 0x3c;
+
+const uint8_t DMI_OP_READ = 1;
+const uint8_t DMI_OP_WRITE = 2;
+
+class GdbServer {
+public:
+  // one dmi access, false if it failed
+  typedef std::function<bool(uint8_t op, uint32_t addr, uint32_t data,
+                             uint32_t &result)>
+      DmiAccess;
+  // access backing memory directly, false if addr is not backed
+  typedef std::function<bool(bool write, uint64_t addr, uint8_t *data,
+                             size_t size)>
+      MemoryAccess;
+
+  GdbServer(DmiAccess dmi, MemoryAccess memory, size_t harts)
+      : dmi(dmi), memory(memory), harts(harts) {}
+
+  bool start(int port) {
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+      perror("socket");
+      return false;
+    }
+    int reuseaddr = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(int));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      perror("bind");
+      return false;
+    }
+    if (listen(listen_fd, 1) == -1) {
+      perror("listen");
+      return false;
+    }
+    fprintf(stderr, "> GDB server listening at :%d\n", port);
+    worker = std::thread([this]() { run(); });
+    return true;
+  }
+
+  // called when the simulation ends, pending dmi accesses fail
+  void stop() {
+    if (worker.joinable()) {
+      exit.store(true);
+      worker.join();
+    }
+    if (listen_fd >= 0) {
+      close(listen_fd);
+      listen_fd = -1;
+    }
+  }
+
+  bool stopping() const { return exit.load(); }
+
+private:
+  DmiAccess dmi;
+  MemoryAccess memory;
+  size_t harts;
+  std::thread worker;
+  std::atomic<bool> exit{false};
+  int listen_fd = -1;
+  int client_fd = -1;
+  bool no_ack = false;
+  // all harts are halted
+  bool halted = false;
+  // memory written while halted, fence.i before resume
+  bool memory_written = false;
+  // hart for register access and stepping
+  size_t current = 0;
+  std::string input;
+
+  // poll interval of the socket and of dmstatus while running
+  static const int POLL_MS = 10;
+
+  bool dmi_read(uint32_t addr, uint32_t &data) {
+    return dmi(DMI_OP_READ, addr, 0, data);
+  }
+
+  bool dmi_write(uint32_t addr, uint32_t data) {
+    uint32_t result;
+    return dmi(DMI_OP_WRITE, addr, data, result);
+  }
+
+  // debug module
+
+  uint32_t dmcontrol(size_t hart) {
+    // dmactive, hartsello and hartselhi
+    return 1 | ((hart & 0x3ff) << 16) | (((hart >> 10) & 0x3ff) << 6);
+  }
+
+  bool select(size_t hart) {
+    return dmi_write(DMI_DMCONTROL, dmcontrol(hart));
+  }
+
+  // allhalted of the selected hart
+  bool is_halted(size_t hart, bool &result) {
+    uint32_t status;
+    if (!select(hart) || !dmi_read(DMI_DMSTATUS, status)) {
+      return false;
+    }
+    result = (status >> 9) & 1;
+    return true;
+  }
+
+  bool halt(size_t hart) {
+    uint32_t status = 0;
+    if (!dmi_write(DMI_DMCONTROL, dmcontrol(hart) | (1u << 31))) {
+      return false;
+    }
+    // allhalted
+    while (!(status & (1 << 9))) {
+      if (stopping() || !dmi_read(DMI_DMSTATUS, status)) {
+        return false;
+      }
+    }
+    return select(hart);
+  }
+
+  bool resume(size_t hart) {
+    uint32_t status = 0;
+    if (!dmi_write(DMI_DMCONTROL, dmcontrol(hart) | (1u << 30))) {
+      return false;
+    }
+    // allresumeack
+    while (!(status & (1 << 17))) {
+      if (stopping() || !dmi_read(DMI_DMSTATUS, status)) {
+        return false;
+      }
+    }
+    return select(hart);
+  }
+
+  bool halt_all() {
+    for (size_t hart = 0; hart < harts; hart++) {
+      bool hart_halted;
+      if (!is_halted(hart, hart_halted) || (!hart_halted && !halt(hart))) {
+        return false;
+      }
+    }
+    halted = true;
+    return true;
+  }
+
+  // run an abstract command, false on cmderr
+  bool command(uint32_t cmd) {
+    uint32_t cs;
+    if (!dmi_write(DMI_COMMAND, cmd)) {
+      return false;
+    }
+    do {
+      if (stopping() || !dmi_read(DMI_ABSTRACTCS, cs)) {
+        return false;
+      }
+    } while (cs & (1 << 12));
+    if ((cs >> 8) & 7) {
+      // clear cmderr
+      dmi_write(DMI_ABSTRACTCS, 7 << 8);
+      return false;
+    }
+    return true;
+  }
+
+  // access register, 64 bit, transfer
+  static uint32_t access_register(uint32_t regno, bool write) {
+    return (3 << 20) | (1 << 17) | (write << 16) | regno;
+  }
+
+  bool read_gpr(int index, uint64_t &value) {
+    uint32_t lo, hi;
+    if (!command(access_register(0x1000 + index, false)) ||
+        !dmi_read(DMI_DATA0, lo) || !dmi_read(DMI_DATA1, hi)) {
+      return false;
+    }
+    value = ((uint64_t)hi << 32) | lo;
+    return true;
+  }
+
+  bool write_gpr(int index, uint64_t value) {
+    return dmi_write(DMI_DATA0, value) && dmi_write(DMI_DATA1, value >> 32) &&
+           command(access_register(0x1000 + index, true));
+  }
+
+  // run one instruction in the program buffer with value in s0, then read
+  // s0 back into value, s0 is preserved
+  bool exec_with_s0(uint32_t instr, uint64_t &value) {
+    uint64_t saved;
+    if (!read_gpr(8, saved) || !dmi_write(DMI_PROGBUF0, instr) ||
+        !dmi_write(DMI_PROGBUF1, 0x00100073) ||
+        !dmi_write(DMI_DATA0, value) || !dmi_write(DMI_DATA1, value >> 32) ||
+        // write s0 and postexec
+        !command(access_register(0x1008, true) | (1 << 18))) {
+      return false;
+    }
+    return read_gpr(8, value) && write_gpr(8, saved);
+  }
+
+  // gdb register numbers: x0-x31, pc, f0-f31, then csrs
+  bool read_register(int regno, uint64_t &value) {
+    if (regno < 32) {
+      return read_gpr(regno, value);
+    } else if (regno == 32) {
+      // dpc
+      return read_csr(0x7b1, value);
+    } else if (regno < 65) {
+      // fmv.x.d s0, fN
+      return exec_with_s0(0xe2000453 | ((regno - 33) << 15), value);
+    } else {
+      return read_csr(regno - 65, value);
+    }
+  }
+
+  bool write_register(int regno, uint64_t value) {
+    if (regno < 32) {
+      return regno == 0 || write_gpr(regno, value);
+    } else if (regno == 32) {
+      return write_csr(0x7b1, value);
+    } else if (regno < 65) {
+      // fmv.d.x fN, s0
+      return exec_with_s0(0xf2040053 | ((regno - 33) << 7), value);
+    } else {
+      return write_csr(regno - 65, value);
+    }
+  }
+
+  bool read_csr(uint32_t csr, uint64_t &value) {
+    // csrr s0, csr
+    return exec_with_s0(0x00002473 | (csr << 20), value);
+  }
+
+  bool write_csr(uint32_t csr, uint64_t value) {
+    // csrw csr, s0
+    return exec_with_s0(0x00041073 | (csr << 20), value);
+  }
+
+  // enter debug mode on ebreak in all privilege modes, set or clear step
+  bool setup_dcsr(bool step) {
+    uint64_t dcsr;
+    if (!read_csr(0x7b0, dcsr)) {
+      return false;
+    }
+    dcsr |= (1 << 15) | (1 << 13) | (1 << 12);
+    dcsr = step ? dcsr | (1 << 2) : dcsr & ~(uint64_t)(1 << 2);
+    return write_csr(0x7b0, dcsr);
+  }
+
+  // fence.i on every hart after memory was written
+  bool sync_icache() {
+    if (!memory_written) {
+      return true;
+    }
+    for (size_t hart = 0; hart < harts; hart++) {
+      if (!select(hart) || !dmi_write(DMI_PROGBUF0, 0x0000100f) ||
+          !dmi_write(DMI_PROGBUF1, 0x00100073) || !command(1 << 18)) {
+        return false;
+      }
+    }
+    memory_written = false;
+    return true;
+  }
+
+  // memory
+
+  // sberror and sbbusyerror, cleared when set
+  bool sba_check() {
+    uint32_t sbcs;
+    if (!dmi_read(DMI_SBCS, sbcs)) {
+      return false;
+    }
+    if (sbcs & ((1 << 22) | (7 << 12))) {
+      dmi_write(DMI_SBCS, (1 << 22) | (7 << 12));
+      return false;
+    }
+    return true;
+  }
+
+  bool sba_wait() {
+    uint32_t sbcs;
+    do {
+      if (stopping() || !dmi_read(DMI_SBCS, sbcs)) {
+        return false;
+      }
+    } while (sbcs & (1 << 21));
+    return true;
+  }
+
+  // words of 32 bits with autoincrement, one byte otherwise; when careful,
+  // wait for sbbusy before every access
+  bool sba_access(bool write, uint64_t addr, uint8_t *data, size_t size,
+                  bool careful) {
+    while (size > 0) {
+      size_t width = (addr % 4 == 0 && size >= 4) ? 4 : 1;
+      size_t count = width == 4 ? size / 4 : 1;
+      // sbaccess, sbautoincrement, and sbreadonaddr/sbreadondata for reads
+      uint32_t sbcs = ((width == 4 ? 2 : 0) << 17) | (1 << 16);
+      if (!write) {
+        sbcs |= (1 << 20) | (count > 1 ? 1 << 15 : 0);
+      }
+      if (!dmi_write(DMI_SBCS, sbcs) ||
+          !dmi_write(DMI_SBADDRESS1, addr >> 32) ||
+          !dmi_write(DMI_SBADDRESS0, addr)) {
+        return false;
+      }
+      for (size_t i = 0; i < count; i++) {
+        uint32_t word = 0;
+        if (careful && !sba_wait()) {
+          return false;
+        }
+        if (write) {
+          memcpy(&word, &data[i * width], width);
+          if (!dmi_write(DMI_SBDATA0, word)) {
+            return false;
+          }
+          continue;
+        }
+        // do not read past the end
+        if (i + 1 == count && count > 1 &&
+            !dmi_write(DMI_SBCS, sbcs & ~(1 << 15))) {
+          return false;
+        }
+        if (!dmi_read(DMI_SBDATA0, word)) {
+          return false;
+        }
+        memcpy(&data[i * width], &word, width);
+      }
+      if ((careful && !sba_wait()) || !sba_check()) {
+        return false;
+      }
+      addr += count * width;
+      data += count * width;
+      size -= count * width;
+    }
+    return true;
+  }
+
+  bool access_memory(bool write, uint64_t addr, uint8_t *data, size_t size) {
+    if (write) {
+      memory_written = true;
+    }
+    if (halted && memory && memory(write, addr, data, size)) {
+      return true;
+    }
+    // retry slowly if the bus was not fast enough
+    return sba_access(write, addr, data, size, false) ||
+           sba_access(write, addr, data, size, true);
+  }
+
+  // protocol
+
+  static std::string hex(const uint8_t *data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string result;
+    for (size_t i = 0; i < size; i++) {
+      result += digits[data[i] >> 4];
+      result += digits[data[i] & 0xf];
+    }
+    return result;
+  }
+
+  static std::vector<uint8_t> unhex(const std::string &text) {
+    std::vector<uint8_t> result;
+    for (size_t i = 0; i + 1 < text.size(); i += 2) {
+      result.push_back(strtoul(text.substr(i, 2).c_str(), NULL, 16));
+    }
+    return result;
+  }
+
+  // register value, little endian
+  static std::string hex_register(uint64_t value) {
+    return hex((const uint8_t *)&value, sizeof(value));
+  }
+
+  static uint64_t unhex_register(const std::string &text) {
+    uint64_t value = 0;
+    std::vector<uint8_t> bytes = unhex(text);
+    memcpy(&value, bytes.data(), std::min(bytes.size(), sizeof(value)));
+    return value;
+  }
+
+  void send(const std::string &data) {
+    uint8_t checksum = 0;
+    for (char c : data) {
+      checksum += c;
+    }
+    char tail[4];
+    snprintf(tail, sizeof(tail), "#%02x", checksum);
+    std::string packet = "$" + data + tail;
+    size_t sent = 0;
+    while (sent < packet.size()) {
+      // a client that went away must not raise SIGPIPE in the simulator
+      ssize_t res = ::send(client_fd, &packet[sent], packet.size() - sent,
+                           MSG_NOSIGNAL);
+      if (res <= 0) {
+        return;
+      }
+      sent += res;
+    }
+  }
+
+  // wait up to POLL_MS for more input, false if the client went away
+  bool receive() {
+    struct pollfd pfd = {client_fd, POLLIN, 0};
+    if (poll(&pfd, 1, POLL_MS) <= 0) {
+      return true;
+    }
+    char buffer[4096];
+    ssize_t num_read = read(client_fd, buffer, sizeof(buffer));
+    if (num_read <= 0) {
+      return false;
+    }
+    input.append(buffer, num_read);
+    return true;
+  }
+
+  // next complete packet in input, or a single 0x03 for interrupt
+  bool next_packet(std::string &packet) {
+    while (!input.empty() && input[0] != '$' && input[0] != 0x03) {
+      // acks
+      input.erase(0, 1);
+    }
+    if (!input.empty() && input[0] == 0x03) {
+      packet = "\x03";
+      input.erase(0, 1);
+      return true;
+    }
+    size_t end = input.find('#');
+    if (input.empty() || end == std::string::npos || end + 3 > input.size()) {
+      return false;
+    }
+    packet = input.substr(1, end - 1);
+    input.erase(0, end + 3);
+    if (!no_ack) {
+      ::send(client_fd, "+", 1, MSG_NOSIGNAL);
+    }
+    return true;
+  }
+
+  std::string stop_reply() {
+    char reply[32];
+    snprintf(reply, sizeof(reply), "T05thread:%lx;", current + 1);
+    return reply;
+  }
+
+  // resume all harts, or step the current one, until one halts
+  std::string run_until_halt(bool step) {
+    if (!sync_icache()) {
+      return "E01";
+    }
+    if (step) {
+      if (!select(current) || !setup_dcsr(true) || !resume(current)) {
+        return "E01";
+      }
+    } else {
+      for (size_t hart = 0; hart < harts; hart++) {
+        if (!select(hart) || !resume(hart)) {
+          return "E01";
+        }
+      }
+    }
+    halted = false;
+
+    while (!stopping()) {
+      std::string packet;
+      if (next_packet(packet) && packet == "\x03") {
+        break;
+      }
+      bool hart_halted = false;
+      size_t hart = step ? current : 0;
+      for (; hart < (step ? current + 1 : harts); hart++) {
+        if (!is_halted(hart, hart_halted)) {
+          return "E01";
+        }
+        if (hart_halted) {
+          break;
+        }
+      }
+      if (hart_halted) {
+        current = hart;
+        break;
+      }
+      if (!receive()) {
+        return "";
+      }
+    }
+    if (!halt_all() || (step && (!select(current) || !setup_dcsr(false)))) {
+      return "E01";
+    }
+    select(current);
+    return stop_reply();
+  }
+
+  std::string handle(const std::string &packet) {
+    // empty packets are legal, reply empty as for unsupported ones
+    if (packet.empty()) {
+      return "";
+    }
+    char kind = packet[0];
+    std::string args = packet.substr(1);
+    if (packet.rfind("qSupported", 0) == 0) {
+      return "PacketSize=4000;QStartNoAckMode+";
+    } else if (packet == "QStartNoAckMode") {
+      no_ack = true;
+      return "OK";
+    } else if (packet == "qAttached") {
+      return "1";
+    } else if (packet == "qC") {
+      char reply[32];
+      snprintf(reply, sizeof(reply), "QC%lx", current + 1);
+      return reply;
+    } else if (packet == "qfThreadInfo") {
+      std::string reply = "m";
+      for (size_t hart = 0; hart < harts; hart++) {
+        char id[32];
+        snprintf(id, sizeof(id), "%s%lx", hart ? "," : "", hart + 1);
+        reply += id;
+      }
+      return reply;
+    } else if (packet == "qsThreadInfo") {
+      return "l";
+    } else if (kind == '?') {
+      return stop_reply();
+    } else if (kind == 'H') {
+      // Hg or Hc, 0 and -1 keep the current hart
+      if (args.empty()) {
+        return "E01";
+      }
+      long thread = strtol(args.substr(1).c_str(), NULL, 16);
+      if (thread > 0 && (size_t)thread <= harts) {
+        current = thread - 1;
+      }
+      return select(current) ? "OK" : "E01";
+    } else if (kind == 'T') {
+      long thread = strtol(args.c_str(), NULL, 16);
+      return thread > 0 && (size_t)thread <= harts ? "OK" : "E01";
+    } else if (kind == 'g') {
+      std::string reply;
+      for (int regno = 0; regno <= 32; regno++) {
+        uint64_t value;
+        if (!read_register(regno, value)) {
+          return "E01";
+        }
+        reply += hex_register(value);
+      }
+      return reply;
+    } else if (kind == 'G') {
+      size_t count = std::min(args.size() / 16, (size_t)33);
+      for (size_t regno = 0; regno < count; regno++) {
+        if (!write_register(regno,
+                            unhex_register(args.substr(regno * 16, 16)))) {
+          return "E01";
+        }
+      }
+      return "OK";
+    } else if (kind == 'p') {
+      uint64_t value;
+      int regno = strtol(args.c_str(), NULL, 16);
+      return read_register(regno, value) ? hex_register(value) : "E01";
+    } else if (kind == 'P') {
+      size_t eq = args.find('=');
+      int regno = strtol(args.c_str(), NULL, 16);
+      return eq != std::string::npos &&
+                     write_register(regno, unhex_register(args.substr(eq + 1)))
+                 ? "OK"
+                 : "E01";
+    } else if (kind == 'm' || kind == 'M') {
+      size_t comma = args.find(',');
+      size_t colon = args.find(':');
+      if (comma == std::string::npos) {
+        return "E01";
+      }
+      uint64_t addr = strtoull(args.c_str(), NULL, 16);
+      size_t size = strtoull(args.c_str() + comma + 1, NULL, 16);
+      // hex reply must fit PacketSize
+      if (size > 0x2000) {
+        return "E01";
+      }
+      std::vector<uint8_t> data(size);
+      if (kind == 'm') {
+        if (!access_memory(false, addr, data.data(), size)) {
+          return "E01";
+        }
+        return hex(data.data(), size);
+      }
+      if (colon == std::string::npos) {
+        return "E01";
+      }
+      data = unhex(args.substr(colon + 1));
+      data.resize(size);
+      return access_memory(true, addr, data.data(), size) ? "OK" : "E01";
+    } else if (kind == 'c') {
+      return run_until_halt(false);
+    } else if (kind == 's') {
+      return run_until_halt(true);
+    } else if (kind == 'D') {
+      return "OK";
+    }
+    // unsupported, including Z breakpoints: gdb writes ebreak itself
+    return "";
+  }
+
+  bool attach() {
+    // activate, then stop everything
+    if (!dmi_write(DMI_DMCONTROL, 1) || !halt_all()) {
+      return false;
+    }
+    for (size_t hart = 0; hart < harts; hart++) {
+      if (!select(hart) || !setup_dcsr(false)) {
+        return false;
+      }
+    }
+    current = 0;
+    return select(current);
+  }
+
+  void detach() {
+    if (halted) {
+      sync_icache();
+      for (size_t hart = 0; hart < harts; hart++) {
+        resume(hart);
+      }
+      halted = false;
+    }
+    close(client_fd);
+    client_fd = -1;
+    fprintf(stderr, "> GDB detached\n");
+  }
+
+  void run() {
+    while (!stopping()) {
+      struct pollfd pfd = {listen_fd, POLLIN, 0};
+      if (poll(&pfd, 1, POLL_MS * 10) <= 0) {
+        continue;
+      }
+      client_fd = accept(listen_fd, NULL, NULL);
+      if (client_fd < 0) {
+        continue;
+      }
+      int flags = 1;
+      setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (void *)&flags,
+                 sizeof(flags));
+      no_ack = false;
+      input.clear();
+      if (!attach()) {
+        fprintf(stderr, "> GDB failed to halt harts\n");
+        close(client_fd);
+        client_fd = -1;
+        continue;
+      }
+      fprintf(stderr, "> GDB attached, %ld harts halted\n", harts);
+
+      bool done = false;
+      while (!stopping() && !done) {
+        std::string packet;
+        if (!next_packet(packet)) {
+          done = !receive();
+          continue;
+        }
+        if (packet == "\x03") {
+          // already halted
+          continue;
+        }
+        std::string reply = handle(packet);
+        send(reply);
+        done = packet[0] == 'D' || packet[0] == 'k';
+      }
+      detach();
+    }
+  }
+};
+
+#endif
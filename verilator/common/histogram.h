@@ -0,0 +1,49 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+// histogram of non negative integer samples, e.g. latency in cycles
+// one bucket per value, so percentiles are exact
+class Histogram {
+public:
+  void add(uint64_t value) {
+    if (value >= counts.size()) {
+      counts.resize(value + 1);
+    }
+    counts[value]++;
+    count++;
+    sum += value;
+  }
+
+  uint64_t get_count() const { return count; }
+  uint64_t get_max() const { return counts.empty() ? 0 : counts.size() - 1; }
+  double get_mean() const { return count ? (double)sum / count : 0.0; }
+
+  // nearest rank percentile, p in (0, 1]
+  uint64_t percentile(double p) const {
+    uint64_t rank = (uint64_t)ceil(p * count);
+    if (rank == 0) {
+      rank = 1;
+    }
+    uint64_t seen = 0;
+    for (uint64_t i = 0; i < counts.size(); i++) {
+      seen += counts[i];
+      if (seen >= rank) {
+        return i;
+      }
+    }
+    return 0;
+  }
+
+  const std::vector<uint64_t> &get_counts() const { return counts; }
+
+private:
+  std::vector<uint64_t> counts;
+  uint64_t count = 0;
+  uint64_t sum = 0;
+};
+
+#endif
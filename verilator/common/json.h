@@ -0,0 +1,116 @@
+#ifndef __JSON_H__
+#define __JSON_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// minimal streaming json writer
+// key is ignored inside arrays
+class JsonWriter {
+public:
+  JsonWriter(FILE *fp) : fp(fp) {}
+
+  void begin_object(const char *key = NULL) {
+    prefix(key);
+    fprintf(fp, "{");
+    first.push_back(true);
+  }
+
+  void end_object() {
+    first.pop_back();
+    newline();
+    fprintf(fp, "}");
+  }
+
+  void begin_array(const char *key = NULL) {
+    prefix(key);
+    fprintf(fp, "[");
+    first.push_back(true);
+  }
+
+  void end_array() {
+    first.pop_back();
+    newline();
+    fprintf(fp, "]");
+  }
+
+  void value(const char *key, uint64_t value) {
+    prefix(key);
+    fprintf(fp, "%lu", value);
+  }
+
+  void value(const char *key, double value) {
+    prefix(key);
+    fprintf(fp, "%.6g", value);
+  }
+
+  void value(const char *key, bool value) {
+    prefix(key);
+    fprintf(fp, value ? "true" : "false");
+  }
+
+  void value(const char *key, const char *value) {
+    prefix(key);
+    if (!value) {
+      fprintf(fp, "null");
+      return;
+    }
+    fputc('"', fp);
+    for (const char *p = value; *p; p++) {
+      if (*p == '"' || *p == '\\') {
+        fprintf(fp, "\\%c", *p);
+      } else if ((unsigned char)*p < 0x20) {
+        fprintf(fp, "\\u%04x", *p);
+      } else {
+        fputc(*p, fp);
+      }
+    }
+    fputc('"', fp);
+  }
+
+  // embed json text as is, or null if empty
+  void raw(const char *key, const std::vector<char> &json) {
+    prefix(key);
+    if (json.empty()) {
+      fprintf(fp, "null");
+    } else {
+      fwrite(json.data(), 1, json.size(), fp);
+    }
+  }
+
+  // array of integers on one line
+  template <typename T>
+  void array(const char *key, const T *values, size_t count) {
+    prefix(key);
+    fprintf(fp, "[");
+    for (size_t i = 0; i < count; i++) {
+      fprintf(fp, i ? ", %lu" : "%lu", (uint64_t)values[i]);
+    }
+    fprintf(fp, "]");
+  }
+
+private:
+  FILE *fp;
+  // no element is written yet in current object or array
+  std::vector<bool> first;
+
+  void newline() {
+    fprintf(fp, "\n%*s", (int)first.size() * 2, "");
+  }
+
+  void prefix(const char *key) {
+    if (!first.empty()) {
+      if (!first.back()) {
+        fprintf(fp, ",");
+      }
+      first.back() = false;
+      newline();
+      if (key) {
+        fprintf(fp, "\"%s\": ", key);
+      }
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef __MEMORY_H__
+#define __MEMORY_H__
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+// sparse guest memory
+// 4 KiB pages are allocated on first write behind a two-level table
+// untouched memory reads as zero and does not allocate
+// pages may also point into an externally owned buffer, see map()
+typedef uint32_t mem_t;
+
+class PagedMemory {
+public:
+  static const uint64_t PAGE_BITS = 12;
+  static const uint64_t PAGE_SIZE = 1L << PAGE_BITS;
+  // 4096 pages per chunk, i.e. 16 MiB per second level table
+  static const uint64_t CHUNK_BITS = 12;
+  static const uint64_t CHUNK_COUNT = 1L << CHUNK_BITS;
+  // 40-bit physical address space
+  static const uint64_t ADDR_BITS = 40;
+  static const uint64_t DIR_COUNT = 1L << (ADDR_BITS - PAGE_BITS - CHUNK_BITS);
+
+  PagedMemory() {
+    dir = (uint8_t ***)calloc(DIR_COUNT, sizeof(uint8_t **));
+    assert(dir);
+  }
+
+  // returns page base pointer, or NULL if page is untouched
+  uint8_t *find_page(uint64_t addr) {
+    uint64_t page_num = addr >> PAGE_BITS;
+    if (page_num == last_page_num) {
+      return last_page;
+    }
+    assert((addr >> ADDR_BITS) == 0);
+    uint8_t **chunk = dir[page_num >> CHUNK_BITS];
+    if (!chunk) {
+      return NULL;
+    }
+    uint8_t *page = chunk[page_num & (CHUNK_COUNT - 1)];
+    if (page) {
+      last_page_num = page_num;
+      last_page = page;
+    }
+    return page;
+  }
+
+  // returns page base pointer, allocate on first touch
+  uint8_t *get_page(uint64_t addr) {
+    uint8_t *page = find_page(addr);
+    if (page) {
+      return page;
+    }
+
+    page = (uint8_t *)calloc(1, PAGE_SIZE);
+    assert(page);
+    install_page(addr, page);
+    return page;
+  }
+
+  // map [data, data + size) to guest [addr, addr + size) without copying
+  // whole pages point into data, partial pages at both ends are copied
+  // data must be writable (e.g. a MAP_PRIVATE mmap, so writes are copy on
+  // write in the kernel) and outlive this memory
+  // returns number of pages mapped in place
+  size_t map(uint64_t addr, uint8_t *data, size_t size) {
+    if (((uint64_t)data & (PAGE_SIZE - 1)) != (addr & (PAGE_SIZE - 1))) {
+      // not congruent, fallback to copy
+      write_bytes(addr, data, size);
+      return 0;
+    }
+
+    uint64_t begin = (addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint64_t end = (addr + size) & ~(PAGE_SIZE - 1);
+    if (begin >= end) {
+      write_bytes(addr, data, size);
+      return 0;
+    }
+    write_bytes(addr, data, begin - addr);
+    write_bytes(end, data + (end - addr), addr + size - end);
+
+    size_t mapped = 0;
+    for (uint64_t page_addr = begin; page_addr < end; page_addr += PAGE_SIZE) {
+      uint8_t *src = data + (page_addr - addr);
+      uint8_t *page = find_page(page_addr);
+      if (page) {
+        // overlaps with existing content
+        memcpy(page, src, PAGE_SIZE);
+      } else {
+        install_page(page_addr, src);
+        mapped++;
+      }
+    }
+    external.push_back(std::make_pair(data, data + size));
+    return mapped;
+  }
+
+  // zero [addr, addr + size), only touches allocated pages
+  void zero(uint64_t addr, size_t size) {
+    while (size > 0) {
+      uint64_t offset = addr & (PAGE_SIZE - 1);
+      size_t len = PAGE_SIZE - offset;
+      if (len > size) {
+        len = size;
+      }
+      uint8_t *page = find_page(addr);
+      if (page) {
+        memset(&page[offset], 0, len);
+      }
+      addr += len;
+      size -= len;
+    }
+  }
+
+  // word access, addr should be aligned to mem_t
+  mem_t read(uint64_t addr) {
+    uint8_t *page = find_page(addr);
+    if (!page) {
+      return 0;
+    }
+    return *(mem_t *)&page[addr & (PAGE_SIZE - 1)];
+  }
+
+  void write(uint64_t addr, mem_t data) {
+    uint8_t *page = get_page(addr);
+    *(mem_t *)&page[addr & (PAGE_SIZE - 1)] = data;
+  }
+
+  // bulk access, may cross page boundary
+  void read_bytes(uint64_t addr, void *data, size_t size) {
+    uint8_t *dst = (uint8_t *)data;
+    while (size > 0) {
+      uint64_t offset = addr & (PAGE_SIZE - 1);
+      size_t len = PAGE_SIZE - offset;
+      if (len > size) {
+        len = size;
+      }
+      uint8_t *page = find_page(addr);
+      if (page) {
+        memcpy(dst, &page[offset], len);
+      } else {
+        memset(dst, 0, len);
+      }
+      addr += len;
+      dst += len;
+      size -= len;
+    }
+  }
+
+  void write_bytes(uint64_t addr, const void *data, size_t size) {
+    const uint8_t *src = (const uint8_t *)data;
+    while (size > 0) {
+      uint64_t offset = addr & (PAGE_SIZE - 1);
+      size_t len = PAGE_SIZE - offset;
+      if (len > size) {
+        len = size;
+      }
+      memcpy(&get_page(addr)[offset], src, len);
+      addr += len;
+      src += len;
+      size -= len;
+    }
+  }
+
+  // number of allocated pages
+  size_t get_page_count() const { return page_count; }
+
+  // visit allocated pages in address order
+  template <typename F> void for_each_page(F f) {
+    for (uint64_t i = 0; i < DIR_COUNT; i++) {
+      if (!dir[i]) {
+        continue;
+      }
+      for (uint64_t j = 0; j < CHUNK_COUNT; j++) {
+        if (dir[i][j]) {
+          f(((i << CHUNK_BITS) | j) << PAGE_BITS, dir[i][j]);
+        }
+      }
+    }
+  }
+
+  // free all pages
+  void clear() {
+    for (uint64_t i = 0; i < DIR_COUNT; i++) {
+      if (!dir[i]) {
+        continue;
+      }
+      for (uint64_t j = 0; j < CHUNK_COUNT; j++) {
+        if (!is_external(dir[i][j])) {
+          free(dir[i][j]);
+        }
+      }
+      free(dir[i]);
+      dir[i] = NULL;
+    }
+    external.clear();
+    page_count = 0;
+    last_page_num = ~0L;
+    last_page = NULL;
+  }
+
+private:
+  uint8_t ***dir = NULL;
+  size_t page_count = 0;
+  // buffers passed to map(), not owned
+  std::vector<std::pair<uint8_t *, uint8_t *>> external;
+
+  // one entry cache of the last accessed page
+  uint64_t last_page_num = ~0L;
+  uint8_t *last_page = NULL;
+
+  void install_page(uint64_t addr, uint8_t *page) {
+    uint64_t page_num = addr >> PAGE_BITS;
+    assert((addr >> ADDR_BITS) == 0);
+    uint8_t **&chunk = dir[page_num >> CHUNK_BITS];
+    if (!chunk) {
+      chunk = (uint8_t **)calloc(CHUNK_COUNT, sizeof(uint8_t *));
+      assert(chunk);
+    }
+    chunk[page_num & (CHUNK_COUNT - 1)] = page;
+    page_count++;
+
+    last_page_num = page_num;
+    last_page = page;
+  }
+
+  bool is_external(uint8_t *page) {
+    for (auto &range : external) {
+      if (range.first <= page && page < range.second) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+#endif
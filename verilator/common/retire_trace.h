@@ -0,0 +1,409 @@
+#ifndef __RETIRE_TRACE_H__
+#define __RETIRE_TRACE_H__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <zstd.h>
+
+// compact binary stream of retired instructions
+//
+// the whole file is one zstd stream of:
+//   header: magic "MV64RTRC", u32 version, u32 fields
+//   records: varint hart, zigzag varint pc delta, u32 instr, then optional
+//     cycle: varint cycle delta
+//     rd: u8 kind (0 none, 1 x, 2 f), u8 rd and u64 value if kind != 0
+//     mem: u8 store, zigzag varint addr delta, u64 data and u8 be if store
+// deltas are relative to the previous record of the same hart
+// all integers are little endian
+
+const char RETIRE_TRACE_MAGIC[8] = {'M', 'V', '6', '4', 'R', 'T', 'R', 'C'};
+const uint32_t RETIRE_TRACE_VERSION = 1;
+
+// optional fields
+const uint32_t RETIRE_TRACE_CYCLE = 1 << 0;
+const uint32_t RETIRE_TRACE_RD = 1 << 1;
+const uint32_t RETIRE_TRACE_MEM = 1 << 2;
+
+const uint32_t RETIRE_TRACE_MAX_HARTS = 64;
+
+struct retire_record {
+  uint32_t hart;
+  uint64_t pc;
+  uint32_t instr;
+  uint64_t cycle;
+  // 0 none, 1 integer, 2 float
+  uint8_t rd_kind;
+  uint8_t rd;
+  uint64_t rd_value;
+  bool store;
+  uint64_t store_addr;
+  uint64_t store_data;
+  uint8_t store_be;
+};
+
+// per hart state for delta encoding
+struct retire_trace_context {
+  uint64_t pc = 0;
+  uint64_t cycle = 0;
+  uint64_t addr = 0;
+};
+
+// encodes records into a buffer, compression and file io run on a
+// background thread so the simulation thread only does the cheap part
+class RetireTraceWriter {
+public:
+  static const size_t CHUNK_SIZE = 1 << 20;
+  // simulation blocks when compression falls this many chunks behind
+  static const size_t MAX_PENDING = 16;
+
+  bool open(const char *path, uint32_t fields) {
+    fp = fopen(path, "wb");
+    if (!fp) {
+      return false;
+    }
+    this->fields = fields;
+    cctx = ZSTD_createCCtx();
+    // favor speed, trace is written while simulating
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, 3);
+    worker = std::thread([this]() { run(); });
+
+    buffer.insert(buffer.end(), RETIRE_TRACE_MAGIC,
+                  RETIRE_TRACE_MAGIC + sizeof(RETIRE_TRACE_MAGIC));
+    put_u32(RETIRE_TRACE_VERSION);
+    put_u32(fields);
+    return true;
+  }
+
+  void write(const retire_record &record) {
+    if (failed) {
+      return;
+    }
+    retire_trace_context &ctx = contexts[record.hart];
+    put_varint(record.hart);
+    put_varint(zigzag(record.pc - ctx.pc));
+    put_u32(record.instr);
+    ctx.pc = record.pc;
+
+    if (fields & RETIRE_TRACE_CYCLE) {
+      put_varint(record.cycle - ctx.cycle);
+      ctx.cycle = record.cycle;
+    }
+    if (fields & RETIRE_TRACE_RD) {
+      buffer.push_back(record.rd_kind);
+      if (record.rd_kind) {
+        buffer.push_back(record.rd);
+        put_u64(record.rd_value);
+      }
+    }
+    if (fields & RETIRE_TRACE_MEM) {
+      buffer.push_back(record.store);
+      if (record.store) {
+        put_varint(zigzag(record.store_addr - ctx.addr));
+        put_u64(record.store_data);
+        buffer.push_back(record.store_be);
+        ctx.addr = record.store_addr;
+      }
+    }
+    count++;
+
+    if (buffer.size() >= CHUNK_SIZE) {
+      submit(false);
+    }
+  }
+
+  // flush everything and wait for the background thread
+  void close() {
+    if (!fp) {
+      return;
+    }
+    submit(true);
+    worker.join();
+    ZSTD_freeCCtx(cctx);
+    fclose(fp);
+    fp = NULL;
+  }
+
+  uint64_t get_count() const { return count; }
+
+  // false once compression or file io failed, the trace is truncated
+  bool ok() const { return !failed; }
+
+private:
+  FILE *fp = NULL;
+  uint32_t fields = 0;
+  uint64_t count = 0;
+  ZSTD_CCtx *cctx = NULL;
+  retire_trace_context contexts[RETIRE_TRACE_MAX_HARTS];
+  std::vector<uint8_t> buffer;
+
+  // chunks waiting for compression, the chunk submitted with done set ends
+  // the stream
+  std::thread worker;
+  std::mutex lock;
+  std::condition_variable cond;
+  std::condition_variable space;
+  std::deque<std::vector<uint8_t>> chunks;
+  // compressed output, only touched by the background thread
+  std::vector<uint8_t> out;
+  bool done = false;
+  // set by the background thread, later records are dropped
+  std::atomic<bool> failed{false};
+
+  void submit(bool last) {
+    std::unique_lock<std::mutex> guard(lock);
+    space.wait(guard, [this]() { return chunks.size() < MAX_PENDING; });
+    chunks.push_back(std::move(buffer));
+    buffer.clear();
+    buffer.reserve(CHUNK_SIZE + 64);
+    done = last;
+    cond.notify_one();
+  }
+
+  void run() {
+    out.resize(ZSTD_CStreamOutSize());
+    while (true) {
+      std::vector<uint8_t> chunk;
+      bool last;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        cond.wait(guard, [this]() { return !chunks.empty(); });
+        chunk = std::move(chunks.front());
+        chunks.pop_front();
+        last = done && chunks.empty();
+        space.notify_one();
+      }
+
+      // keep draining after a failure so submit never blocks
+      if (!failed && !compress(chunk, last)) {
+        failed = true;
+      }
+
+      if (last) {
+        return;
+      }
+    }
+  }
+
+  bool compress(const std::vector<uint8_t> &chunk, bool last) {
+    ZSTD_inBuffer input = {chunk.data(), chunk.size(), 0};
+    ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+    size_t remaining;
+    do {
+      ZSTD_outBuffer output = {out.data(), out.size(), 0};
+      remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+      if (ZSTD_isError(remaining)) {
+        fprintf(stderr, "> Retire trace compression failed: %s\n",
+                ZSTD_getErrorName(remaining));
+        return false;
+      }
+      if (fwrite(out.data(), 1, output.pos, fp) != output.pos) {
+        perror("> Retire trace write failed");
+        return false;
+      }
+    } while (last ? remaining != 0 : input.pos < input.size);
+    return true;
+  }
+
+  static uint64_t zigzag(uint64_t delta) {
+    return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+  }
+
+  void put_varint(uint64_t value) {
+    while (value >= 0x80) {
+      buffer.push_back((value & 0x7F) | 0x80);
+      value >>= 7;
+    }
+    buffer.push_back(value);
+  }
+
+  void put_u32(uint32_t value) {
+    uint8_t *p = (uint8_t *)&value;
+    buffer.insert(buffer.end(), p, p + sizeof(value));
+  }
+
+  void put_u64(uint64_t value) {
+    uint8_t *p = (uint8_t *)&value;
+    buffer.insert(buffer.end(), p, p + sizeof(value));
+  }
+};
+
+// decodes a stream written by RetireTraceWriter
+class RetireTraceReader {
+public:
+  bool open(const char *path) {
+    fp = fopen(path, "rb");
+    if (!fp) {
+      return false;
+    }
+    dctx = ZSTD_createDCtx();
+    input.resize(ZSTD_DStreamInSize());
+
+    char magic[sizeof(RETIRE_TRACE_MAGIC)];
+    uint32_t version;
+    if (!get(magic, sizeof(magic)) ||
+        memcmp(magic, RETIRE_TRACE_MAGIC, sizeof(magic)) != 0 ||
+        !get(&version, sizeof(version)) || version != RETIRE_TRACE_VERSION ||
+        !get(&fields, sizeof(fields))) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  // returns false at end of stream
+  bool next(retire_record &record) {
+    memset(&record, 0, sizeof(record));
+    uint64_t hart, pc;
+    if (!get_varint(hart) || hart >= RETIRE_TRACE_MAX_HARTS ||
+        !get_varint(pc) || !get(&record.instr, sizeof(record.instr))) {
+      return false;
+    }
+    retire_trace_context &ctx = contexts[hart];
+    record.hart = hart;
+    record.pc = ctx.pc += unzigzag(pc);
+
+    if (fields & RETIRE_TRACE_CYCLE) {
+      uint64_t cycle;
+      if (!get_varint(cycle)) {
+        return false;
+      }
+      record.cycle = ctx.cycle += cycle;
+    }
+    if (fields & RETIRE_TRACE_RD) {
+      if (!get(&record.rd_kind, 1)) {
+        return false;
+      }
+      if (record.rd_kind && (!get(&record.rd, 1) ||
+                             !get(&record.rd_value, sizeof(uint64_t)))) {
+        return false;
+      }
+    }
+    if (fields & RETIRE_TRACE_MEM) {
+      uint8_t store;
+      if (!get(&store, 1)) {
+        return false;
+      }
+      record.store = store;
+      if (store) {
+        uint64_t addr;
+        if (!get_varint(addr) ||
+            !get(&record.store_data, sizeof(uint64_t)) ||
+            !get(&record.store_be, 1)) {
+          return false;
+        }
+        record.store_addr = ctx.addr += unzigzag(addr);
+      }
+    }
+    return true;
+  }
+
+  void close() {
+    if (fp) {
+      fclose(fp);
+      fp = NULL;
+    }
+    if (dctx) {
+      ZSTD_freeDCtx(dctx);
+      dctx = NULL;
+    }
+  }
+
+  uint32_t get_fields() const { return fields; }
+
+private:
+  FILE *fp = NULL;
+  uint32_t fields = 0;
+  ZSTD_DCtx *dctx = NULL;
+  retire_trace_context contexts[RETIRE_TRACE_MAX_HARTS];
+
+  // compressed input and decompressed output not yet consumed
+  std::vector<uint8_t> input;
+  ZSTD_inBuffer in = {NULL, 0, 0};
+  std::vector<uint8_t> output;
+  size_t output_pos = 0;
+  // last hint of ZSTD_decompressStream, 0 when a frame has just ended
+  size_t frame_remaining = 1;
+
+  bool fill() {
+    output.resize(ZSTD_DStreamOutSize());
+    output_pos = 0;
+    while (true) {
+      bool eof = false;
+      if (in.pos == in.size) {
+        size_t size = fread(input.data(), 1, input.size(), fp);
+        // keep calling with empty input, zstd may still hold output
+        eof = size == 0;
+        in = {input.data(), size, 0};
+      }
+      size_t in_pos = in.pos;
+      ZSTD_outBuffer out = {output.data(), output.size(), 0};
+      size_t ret = ZSTD_decompressStream(dctx, &out, &in);
+      if (ZSTD_isError(ret)) {
+        fprintf(stderr, "> Retire trace decompression failed: %s\n",
+                ZSTD_getErrorName(ret));
+        output.clear();
+        return false;
+      }
+      if (out.pos > 0) {
+        frame_remaining = ret;
+        output.resize(out.pos);
+        return true;
+      }
+      if (eof) {
+        if (frame_remaining != 0) {
+          fprintf(stderr, "> Retire trace is truncated, zstd frame is "
+                          "incomplete\n");
+        }
+        output.clear();
+        return false;
+      }
+      if (in.pos > in_pos) {
+        frame_remaining = ret;
+      }
+    }
+  }
+
+  bool get(void *data, size_t size) {
+    uint8_t *dst = (uint8_t *)data;
+    while (size > 0) {
+      if (output_pos == output.size() && !fill()) {
+        return false;
+      }
+      size_t len = std::min(size, output.size() - output_pos);
+      memcpy(dst, &output[output_pos], len);
+      output_pos += len;
+      dst += len;
+      size -= len;
+    }
+    return true;
+  }
+
+  bool get_varint(uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t byte;
+      if (!get(&byte, 1)) {
+        return false;
+      }
+      value |= (uint64_t)(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static uint64_t unzigzag(uint64_t value) {
+    return (value >> 1) ^ -(value & 1);
+  }
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef __SYMBOLIZER_H__
+#define __SYMBOLIZER_H__
+
+#include <algorithm>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __APPLE__
+#include "elf-local.h"
+#else
+#include <elf.h>
+#endif
+
+// maps guest addresses to enclosing function symbols
+class Symbolizer {
+public:
+  // add one symbol, size 0 extends to the next symbol
+  void add(const std::string &name, uint64_t addr, uint64_t size) {
+    symbols.push_back(symbol{addr, size, name});
+    sorted = false;
+  }
+
+  // add function and object symbols from the symbol table of an elf
+  bool load_elf(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st = {};
+    fstat(fd, &st);
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      return false;
+    }
+
+    const uint8_t *buffer = (const uint8_t *)map;
+    const Elf64_Ehdr *hdr = (const Elf64_Ehdr *)buffer;
+    bool ok = (size_t)st.st_size >= sizeof(Elf64_Ehdr) &&
+              memcmp(hdr->e_ident, ELFMAG, SELFMAG) == 0 &&
+              hdr->e_ident[EI_CLASS] == ELFCLASS64;
+    if (ok) {
+      const Elf64_Shdr *shdrs = (const Elf64_Shdr *)&buffer[hdr->e_shoff];
+      for (int i = 0; i < hdr->e_shnum; i++) {
+        if (shdrs[i].sh_type != SHT_SYMTAB) {
+          continue;
+        }
+        const Elf64_Sym *syms = (const Elf64_Sym *)&buffer[shdrs[i].sh_offset];
+        const char *strtab =
+            (const char *)&buffer[shdrs[shdrs[i].sh_link].sh_offset];
+        for (size_t j = 0; j < shdrs[i].sh_size / sizeof(Elf64_Sym); j++) {
+          int type = ELF64_ST_TYPE(syms[j].st_info);
+          if (syms[j].st_name && syms[j].st_shndx != SHN_UNDEF &&
+              (type == STT_FUNC || type == STT_NOTYPE)) {
+            add(strtab + syms[j].st_name, syms[j].st_value, syms[j].st_size);
+          }
+        }
+      }
+    }
+    munmap(map, st.st_size);
+    return ok;
+  }
+
+  // name of function containing addr, or NULL
+  const char *lookup(uint64_t addr) {
+    if (!sorted) {
+      sort();
+    }
+    auto it = cache.find(addr);
+    if (it != cache.end()) {
+      return it->second;
+    }
+
+    const char *name = NULL;
+    // last symbol starting at or before addr
+    auto upper = std::upper_bound(
+        symbols.begin(), symbols.end(), addr,
+        [](uint64_t addr, const symbol &sym) { return addr < sym.addr; });
+    if (upper != symbols.begin()) {
+      const symbol &sym = *(upper - 1);
+      uint64_t end = sym.size ? sym.addr + sym.size
+                              : (upper != symbols.end() ? upper->addr : ~0L);
+      if (addr < end) {
+        name = sym.name.c_str();
+      }
+    }
+    cache[addr] = name;
+    return name;
+  }
+
+  size_t size() const { return symbols.size(); }
+
+private:
+  struct symbol {
+    uint64_t addr;
+    uint64_t size;
+    std::string name;
+  };
+  std::vector<symbol> symbols;
+  bool sorted = true;
+  std::unordered_map<uint64_t, const char *> cache;
+
+  // sort by address, prefer sized symbols (functions) over labels at the
+  // same address
+  void sort() {
+    std::sort(symbols.begin(), symbols.end(),
+              [](const symbol &a, const symbol &b) {
+                if (a.addr != b.addr) {
+                  return a.addr < b.addr;
+                }
+                return a.size < b.size;
+              });
+    // keep the last of equal addresses, i.e. the sized one
+    std::vector<symbol> unique;
+    for (size_t i = 0; i < symbols.size(); i++) {
+      if (i + 1 < symbols.size() && symbols[i + 1].addr == symbols[i].addr) {
+        continue;
+      }
+      unique.push_back(symbols[i]);
+    }
+    symbols.swap(unique);
+    cache.clear();
+    sorted = true;
+  }
+};
+
+#endif
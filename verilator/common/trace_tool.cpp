@@ -0,0 +1,99 @@
+// read retire trace written by VRiscVSystem --retire-trace
+// print records, or a flat instruction profile by function with -p
+#include "retire_trace.h"
+#include "symbolizer.h"
+#include <getopt.h>
+#include <map>
+#include <string>
+
+int main(int argc, char **argv) {
+  int opt;
+  bool profile = false;
+  std::vector<const char *> elfs;
+  while ((opt = getopt(argc, argv, "e:p")) != -1) {
+    switch (opt) {
+    case 'e':
+      elfs.push_back(optarg);
+      break;
+    case 'p':
+      profile = true;
+      break;
+    default: /* '?' */
+      fprintf(stderr, "Usage: %s [-e elf]... [-p] trace\n", argv[0]);
+      return 1;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Usage: %s [-e elf]... [-p] trace\n", argv[0]);
+    return 1;
+  }
+
+  Symbolizer symbolizer;
+  for (const char *elf : elfs) {
+    if (!symbolizer.load_elf(elf)) {
+      fprintf(stderr, "> Failed to load symbols from %s\n", elf);
+      return 1;
+    }
+  }
+
+  RetireTraceReader reader;
+  if (!reader.open(argv[optind])) {
+    fprintf(stderr, "> Failed to open trace %s\n", argv[optind]);
+    return 1;
+  }
+
+  // instructions retired per function and hart
+  std::map<std::string, std::vector<uint64_t>> functions;
+  uint64_t total = 0;
+  retire_record record;
+  while (reader.next(record)) {
+    total++;
+    const char *name = symbolizer.lookup(record.pc);
+    if (profile) {
+      std::vector<uint64_t> &counts = functions[name ? name : "[unknown]"];
+      if (counts.size() <= record.hart) {
+        counts.resize(record.hart + 1);
+      }
+      counts[record.hart]++;
+      continue;
+    }
+
+    printf("%d", record.hart);
+    if (reader.get_fields() & RETIRE_TRACE_CYCLE) {
+      printf(" %ld", record.cycle);
+    }
+    printf(" %016lx %08x", record.pc, record.instr);
+    if (record.rd_kind) {
+      printf(" %c%d=%016lx", record.rd_kind == 1 ? 'x' : 'f', record.rd,
+             record.rd_value);
+    }
+    if (record.store) {
+      printf(" [%lx]=%016lx/%02x", record.store_addr, record.store_data,
+             record.store_be);
+    }
+    if (name) {
+      printf(" <%s>", name);
+    }
+    printf("\n");
+  }
+  reader.close();
+
+  if (profile) {
+    std::vector<std::pair<uint64_t, std::string>> sorted;
+    for (auto &it : functions) {
+      uint64_t sum = 0;
+      for (uint64_t count : it.second) {
+        sum += count;
+      }
+      sorted.push_back(std::make_pair(sum, it.first));
+    }
+    std::sort(sorted.rbegin(), sorted.rend());
+    printf("%12s %7s  %s\n", "instret", "percent", "function");
+    for (auto &it : sorted) {
+      printf("%12ld %6.2lf%%  %s\n", it.first, it.first * 100.0 / total,
+             it.second.c_str());
+    }
+  }
+  fprintf(stderr, "> Read %ld records\n", total);
+  return 0;
+}
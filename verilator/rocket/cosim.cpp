@@ -0,0 +1,222 @@
+#include "cosim.h"
+#include <iostream>
+#include <map>
+#include <riscv/cfg.h>
+#include <riscv/processor.h>
+#include <riscv/simif.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <vector>
+
+// minimal spike environment: flat memory, everything else is mmio that
+// reads as zero, its results are taken from the dut
+class cosim_sim : public simif_t {
+public:
+  cosim_sim(const char *isa, uint64_t mem_base, uint64_t mem_size)
+      : mem_base(mem_base), mem_size(mem_size) {
+    cfg.isa = isa;
+    cfg.priv = "MSU";
+    // lazily allocated by the kernel
+    mem = (char *)mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+      fprintf(stderr, "> Failed to allocate cosim memory\n");
+      exit(1);
+    }
+  }
+
+  char *addr_to_mem(reg_t paddr) override {
+    if (paddr >= mem_base && paddr - mem_base < mem_size) {
+      return mem + (paddr - mem_base);
+    }
+    return NULL;
+  }
+
+  bool mmio_load(reg_t paddr, size_t len, uint8_t *bytes) override {
+    memset(bytes, 0, len);
+    mmio_accessed = true;
+    return true;
+  }
+
+  bool mmio_store(reg_t paddr, size_t len, const uint8_t *bytes) override {
+    mmio_accessed = true;
+    return true;
+  }
+
+  void proc_reset(unsigned id) override {}
+  const cfg_t &get_cfg() const override { return cfg; }
+  const std::map<size_t, processor_t *> &get_harts() const override {
+    return harts;
+  }
+  const char *get_symbol(uint64_t paddr) override { return NULL; }
+
+  cfg_t cfg;
+  std::map<size_t, processor_t *> harts;
+  char *mem;
+  uint64_t mem_base;
+  uint64_t mem_size;
+  // set by mmio access during current step
+  bool mmio_accessed = false;
+};
+
+struct cosim_hart {
+  processor_t *proc;
+  bool started;
+  // start at any pc, registers are seeded
+  bool seeded;
+  uint64_t checked;
+  // dut register writes before checking starts
+  uint64_t xpr[32];
+  uint64_t fpr[32];
+};
+
+cosim_sim *sim;
+std::vector<cosim_hart> harts;
+uint64_t start_pc;
+
+void cosim_init(const char *isa, size_t count, uint64_t mem_base,
+                uint64_t mem_size, uint64_t pc) {
+  sim = new cosim_sim(isa, mem_base, mem_size);
+  start_pc = pc;
+  harts.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    cosim_hart &hart = harts[i];
+    hart.proc = new processor_t(isa, "MSU", &sim->cfg, sim, i, false, stderr,
+                                std::cout);
+    hart.proc->reset();
+    hart.started = false;
+    hart.seeded = false;
+    hart.checked = 0;
+    memset(hart.xpr, 0, sizeof(hart.xpr));
+    memset(hart.fpr, 0, sizeof(hart.fpr));
+    sim->harts[i] = hart.proc;
+  }
+  fprintf(stderr, "> Cosim with spike isa=%s harts=%ld from pc %lx\n", isa,
+          count, start_pc);
+}
+
+void cosim_write_memory(uint64_t addr, const void *data, size_t size) {
+  const uint8_t *src = (const uint8_t *)data;
+  for (size_t i = 0; i < size; i++) {
+    char *dst = sim->addr_to_mem(addr + i);
+    if (dst) {
+      *dst = src[i];
+    }
+  }
+}
+
+void cosim_seed(size_t index, const uint64_t *xpr, const uint64_t *fpr) {
+  cosim_hart &hart = harts[index];
+  memcpy(hart.xpr, xpr, sizeof(hart.xpr));
+  memcpy(hart.fpr, fpr, sizeof(hart.fpr));
+  hart.seeded = true;
+}
+
+uint64_t cosim_checked(size_t hart) { return harts[hart].checked; }
+
+// csr reads whose value depends on timing, e.g. counters and mip
+bool is_timing_csr_read(uint32_t instr) {
+  uint32_t opcode = instr & 0x7F;
+  uint32_t funct3 = (instr >> 12) & 0x7;
+  uint32_t csr = instr >> 20;
+  if (opcode != 0x73 || funct3 == 0) {
+    return false;
+  }
+  return (csr >= 0xB00 && csr < 0xB20) || (csr >= 0xC00 && csr < 0xC20) ||
+         csr == 0x344;
+}
+
+void report(size_t index, const cosim_retire &retire, const char *what) {
+  cosim_hart &hart = harts[index];
+  fprintf(stderr,
+          "> Cosim divergence on hart %ld after %ld instructions: %s\n",
+          index, hart.checked, what);
+  fprintf(stderr, "> dut: pc=%lx instr=%08x", retire.pc, retire.instr);
+  if (retire.wen) {
+    fprintf(stderr, " %c%d=%lx", retire.rd_float ? 'f' : 'x', retire.rd,
+            retire.wdata);
+  }
+  if (retire.store) {
+    fprintf(stderr, " store %lx=%lx be=%x", retire.store_addr,
+            retire.store_data, retire.store_be);
+  }
+  fprintf(stderr, "\n");
+}
+
+bool cosim_check(size_t index, const cosim_retire &retire) {
+  cosim_hart &hart = harts[index];
+  state_t *state = hart.proc->get_state();
+
+  if (!hart.started) {
+    if (retire.pc != start_pc && !hart.seeded) {
+      if (retire.wen && retire.rd_float) {
+        hart.fpr[retire.rd] = retire.wdata;
+      } else if (retire.wen) {
+        hart.xpr[retire.rd] = retire.wdata;
+      }
+      return true;
+    }
+    hart.started = true;
+    for (int i = 1; i < 32; i++) {
+      state->XPR.write(i, hart.xpr[i]);
+      state->FPR.write(i, freg_t{{hart.fpr[i], ~0ULL}});
+    }
+    state->pc = retire.pc;
+  }
+
+  // dut does not report instructions trapped by exceptions, let the reference
+  // take the same trap
+  if (state->pc != retire.pc) {
+    sim->mmio_accessed = false;
+    hart.proc->step(1);
+  }
+  if (state->pc != retire.pc) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "pc mismatch, expected %lx",
+             (uint64_t)state->pc);
+    report(index, retire, buffer);
+    return false;
+  }
+
+  sim->mmio_accessed = false;
+  hart.proc->step(1);
+  hart.checked++;
+
+  if (retire.wen) {
+    uint64_t expected = retire.rd_float ? state->FPR[retire.rd].v[0]
+                                        : state->XPR[retire.rd];
+    if (sim->mmio_accessed || is_timing_csr_read(retire.instr)) {
+      // not modelled by the reference, follow the dut
+      if (retire.rd_float) {
+        state->FPR.write(retire.rd, freg_t{{retire.wdata, ~0ULL}});
+      } else {
+        state->XPR.write(retire.rd, retire.wdata);
+      }
+    } else if (expected != retire.wdata) {
+      char buffer[64];
+      snprintf(buffer, sizeof(buffer), "register mismatch, expected %lx",
+               expected);
+      report(index, retire, buffer);
+      return false;
+    }
+  }
+
+  if (retire.store) {
+    // compare memory of the reference after its store
+    for (int i = 0; i < 8; i++) {
+      if ((retire.store_be >> i) & 1) {
+        char *byte = sim->addr_to_mem(retire.store_addr + i);
+        uint8_t data = retire.store_data >> (i * 8);
+        if (byte && (uint8_t)*byte != data) {
+          char buffer[64];
+          snprintf(buffer, sizeof(buffer), "store mismatch at %lx",
+                   retire.store_addr + i);
+          report(index, retire, buffer);
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
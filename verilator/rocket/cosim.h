@@ -0,0 +1,45 @@
+#ifndef __COSIM_H__
+#define __COSIM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// lockstep co-simulation against spike
+// spike headers conflict with the harness (e.g. mem_t), so they are only
+// included by cosim.cpp
+
+// one instruction retired by the dut, see RetireTrace in Core.scala
+struct cosim_retire {
+  uint64_t pc;
+  uint32_t instr;
+  bool wen;
+  bool rd_float;
+  uint8_t rd;
+  uint64_t wdata;
+  bool store;
+  uint64_t store_addr;
+  uint64_t store_data;
+  uint8_t store_be;
+};
+
+// create reference harts backed by [mem_base, mem_base + mem_size)
+// checking starts when a hart first retires at start_pc, registers written
+// before that (e.g. by bootrom) are copied to the reference
+void cosim_init(const char *isa, size_t harts, uint64_t mem_base,
+                uint64_t mem_size, uint64_t start_pc);
+
+// copy initial guest memory, out of range parts are ignored
+void cosim_write_memory(uint64_t addr, const void *data, size_t size);
+
+// start checking at the next retired instruction from these registers, e.g.
+// after restoring a checkpoint, csrs of the reference keep reset values
+void cosim_seed(size_t hart, const uint64_t *xpr, const uint64_t *fpr);
+
+// step reference hart by one instruction and compare pc, register write and
+// store, print a report and return false on first divergence
+bool cosim_check(size_t hart, const cosim_retire &retire);
+
+// number of instructions compared on hart
+uint64_t cosim_checked(size_t hart);
+
+#endif
@@ -1,18 +1,43 @@
 #include "VRiscVSystem.h"
 #include "memory_system.h"
+#include <algorithm>
 #include <arpa/inet.h>
+#include <atomic>
 #include <bits/getopt_core.h>
 #include <deque>
+#include <errno.h>
 #include <fcntl.h>
-#include <gmpxx.h>
+#include <getopt.h>
 #include <map>
 #include <netinet/tcp.h>
 #include <signal.h>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <verilated.h>
 #include <verilated_fst_c.h>
+#ifdef SAVABLE
+#include <verilated_save.h>
+#endif
+
+#include "../common/axi.h"
+#include "../common/gdbserver.h"
+#include "../common/histogram.h"
+#include "../common/json.h"
+#include "../common/memory.h"
+#include "../common/retire_trace.h"
+#include "../common/symbolizer.h"
+#ifdef COSIM
+#include "cosim.h"
+#endif
 
 #ifdef __APPLE__
 #include "elf-local.h"
@@ -21,8 +46,7 @@
 #endif
 
 // memory mapping
-typedef uint32_t mem_t;
-std::map<uint64_t, mem_t> memory;
+PagedMemory memory;
 
 // align to mem_t boundary
 uint64_t align(uint64_t addr) { return (addr / sizeof(mem_t)) * sizeof(mem_t); }
@@ -39,6 +63,8 @@ bool jtag = false;
 bool jtag_rbb = false;
 // use jtag_vpi protocol
 bool jtag_vpi = false;
+// gdbserver port, 0 if disabled
+int gdb_port = 0;
 // use DRAMsim3
 bool dram = false;
 dramsim3::MemorySystem *dram_system;
@@ -87,11 +113,82 @@ uint64_t fromhost_addr = 0x60000040;
 uint64_t serial_addr = 0x60001000;
 uint64_t serial_fpga_addr = 0x60201000;
 
+// fast console
+// a 64-bit store of (length << 48 | address) prints the buffer in one go,
+// it must lie in the uncached staging buffer, one page of mmio space that is
+// printed in place, dirty lines in the caches would be missed elsewhere
+uint64_t console_addr = 0x60002000;
+uint64_t console_buffer_addr = 0x60003000;
+const uint64_t CONSOLE_BUFFER_SIZE = 0x1000;
+// stdout is flushed per line, or only at exit with --console-flush-exit
+bool console_flush_exit = false;
+const size_t CONSOLE_MAX_PENDING = 1 << 16;
+std::string console_out;
+
+void console_flush() {
+  if (!console_out.empty()) {
+    fwrite(console_out.data(), 1, console_out.size(), stdout);
+    console_out.clear();
+  }
+  fflush(stdout);
+}
+
+void console_write(const char *data, size_t len) {
+  console_out.append(data, len);
+  if (console_out.size() >= CONSOLE_MAX_PENDING ||
+      (!console_flush_exit &&
+       std::find(data, data + len, '\n') != data + len)) {
+    console_flush();
+  }
+}
+
 // signature generation for riscv-torture
 uint64_t begin_signature = 0;
 uint64_t begin_signature_override = 0;
 uint64_t end_signature = 0;
 
+// deadlock exit
+// harts whose pc stays in these functions are parked, the run fails once
+// every hart is parked and nothing can wake them up. this ends hopeless
+// runs early but never skips time, mtime and mcycle live in the model
+bool deadlock_exit = false;
+std::vector<std::string> park_symbols = {"spin"};
+std::vector<std::pair<uint64_t, uint64_t>> park_ranges;
+
+// tracing
+bool trace_enabled = false;
+// writer of the current trace file, null when not tracing
+VerilatedFstC *tfp = nullptr;
+int trace_depth = 99;
+// only trace within [trace_begin, trace_end) mcycle
+uint64_t trace_begin = 0;
+uint64_t trace_end = ~0L;
+// triggers: start tracing, or stop ring buffer when fired
+bool trace_on_pc = false;
+uint64_t trace_pc = 0;
+bool trace_on_tohost = false;
+uint64_t trace_tohost = 0;
+bool trace_on_write = false;
+uint64_t trace_write_addr = 0;
+bool trace_triggered = false;
+// ring buffer: keep at least last trace_ring_cycles cycles in two files
+uint64_t trace_ring_cycles = 0;
+
+void trace_fire(const char *reason) {
+  if (!trace_triggered) {
+    trace_triggered = true;
+    fprintf(stderr, "> Trace triggered by %s\n", reason);
+  }
+}
+
+// check write trigger for a beat of (1 << size) bytes at addr
+void trace_check_write(uint64_t addr, uint64_t size) {
+  if (trace_on_write && addr <= trace_write_addr &&
+      trace_write_addr < addr + (1L << size)) {
+    trace_fire("write");
+  }
+}
+
 void ctrlc_handler(int arg) {
   fprintf(stderr, "Received Ctrl-C\n");
   finished = true;
@@ -118,36 +215,670 @@ void init() {
   top->interrupts = 0x3;
 }
 
+// retire trace of one slot, see RetireTrace in Core.scala
+struct retire_trace {
+  CData *valid;
+  QData *pc;
+  IData *instr;
+  CData *wen;
+  CData *rdFloat;
+  CData *rd;
+  QData *wdata;
+  CData *store;
+  QData *storeAddr;
+  QData *storeData;
+  CData *storeBe;
+};
+const size_t RETIRE_NUM = 2;
+
+// top-down slots per cycle, see TopDownEvents in Core.scala
+const size_t TOP_DOWN_COUNT = 7;
+const char *top_down_names[TOP_DOWN_COUNT] = {
+    "frontend_bound",     "bad_speculation",      "backend_memory_bound",
+    "backend_core_bound", "retiring",             "frontend_icache_miss",
+    "frontend_redirect"};
+
+// debug signals of one core
+struct core_debug {
+  QData *pc;
+  QData *minstret;
+  QData *mcycle;
+  CData *iqEmptyMask;
+  CData *iqFullMask;
+  CData *issueNum;
+  CData *issueNumBoundedByROBSize;
+  CData *issueNumBoundedByLSQSize;
+  CData *retireNum;
+  CData *intEnabled;
+  // retire ports only exist with retireTrace in WithMeowV64Cores
+  bool has_retire;
+  retire_trace retire[RETIRE_NUM];
+  CData *topDown[TOP_DOWN_COUNT];
+};
+std::vector<core_debug> cores;
+
+// probe debug_N_* ports of the generated model
+template <typename T, int N, typename = void> struct core_debug_probe {
+  static bool probe(T *top, core_debug &debug) { return false; }
+};
+
+template <typename T, int N, typename = void> struct retire_probe {
+  static bool probe(T *top, core_debug &debug) { return false; }
+};
+
+#define RETIRE_TRACE_PROBE(N, M)                                               \
+  debug.retire[M].valid = &top->debug_##N##_retire_##M##_valid;                \
+  debug.retire[M].pc = &top->debug_##N##_retire_##M##_pc;                      \
+  debug.retire[M].instr = &top->debug_##N##_retire_##M##_instr;                \
+  debug.retire[M].wen = &top->debug_##N##_retire_##M##_wen;                    \
+  debug.retire[M].rdFloat = &top->debug_##N##_retire_##M##_rdFloat;            \
+  debug.retire[M].rd = &top->debug_##N##_retire_##M##_rd;                      \
+  debug.retire[M].wdata = &top->debug_##N##_retire_##M##_wdata;                \
+  debug.retire[M].store = &top->debug_##N##_retire_##M##_store;                \
+  debug.retire[M].storeAddr = &top->debug_##N##_retire_##M##_storeAddr;        \
+  debug.retire[M].storeData = &top->debug_##N##_retire_##M##_storeData;        \
+  debug.retire[M].storeBe = &top->debug_##N##_retire_##M##_storeBe;
+
+#define RETIRE_PROBE(N)                                                        \
+  template <typename T>                                                        \
+  struct retire_probe<T, N, decltype((void)T::debug_##N##_retire_0_valid)> {   \
+    static bool probe(T *top, core_debug &debug) {                             \
+      RETIRE_TRACE_PROBE(N, 0)                                                 \
+      RETIRE_TRACE_PROBE(N, 1)                                                 \
+      return true;                                                             \
+    }                                                                          \
+  };
+
+#define CORE_DEBUG_PROBE(N)                                                    \
+  template <typename T>                                                        \
+  struct core_debug_probe<T, N, decltype((void)T::debug_##N##_pc)> {           \
+    static bool probe(T *top, core_debug &debug) {                             \
+      debug.pc = &top->debug_##N##_pc;                                         \
+      debug.minstret = &top->debug_##N##_minstret;                             \
+      debug.mcycle = &top->debug_##N##_mcycle;                                 \
+      debug.iqEmptyMask = &top->debug_##N##_iqEmptyMask;                       \
+      debug.iqFullMask = &top->debug_##N##_iqFullMask;                         \
+      debug.issueNum = &top->debug_##N##_issueNum;                             \
+      debug.issueNumBoundedByROBSize =                                         \
+          &top->debug_##N##_issueNumBoundedByROBSize;                          \
+      debug.issueNumBoundedByLSQSize =                                         \
+          &top->debug_##N##_issueNumBoundedByLSQSize;                          \
+      debug.retireNum = &top->debug_##N##_retireNum;                           \
+      debug.intEnabled = &top->debug_##N##_intEnabled;                         \
+      debug.has_retire = retire_probe<T, N>::probe(top, debug);                \
+      debug.topDown[0] = &top->debug_##N##_topDown_frontendBound;              \
+      debug.topDown[1] = &top->debug_##N##_topDown_badSpeculation;             \
+      debug.topDown[2] = &top->debug_##N##_topDown_backendMemoryBound;         \
+      debug.topDown[3] = &top->debug_##N##_topDown_backendCoreBound;           \
+      debug.topDown[4] = &top->debug_##N##_topDown_retiring;                   \
+      debug.topDown[5] = &top->debug_##N##_topDown_frontendICacheMiss;         \
+      debug.topDown[6] = &top->debug_##N##_topDown_frontendRedirect;           \
+      return true;                                                             \
+    }                                                                          \
+  };
+RETIRE_PROBE(0)
+RETIRE_PROBE(1)
+RETIRE_PROBE(2)
+RETIRE_PROBE(3)
+RETIRE_PROBE(4)
+RETIRE_PROBE(5)
+RETIRE_PROBE(6)
+RETIRE_PROBE(7)
+RETIRE_PROBE(8)
+RETIRE_PROBE(9)
+RETIRE_PROBE(10)
+RETIRE_PROBE(11)
+RETIRE_PROBE(12)
+RETIRE_PROBE(13)
+RETIRE_PROBE(14)
+RETIRE_PROBE(15)
+CORE_DEBUG_PROBE(0)
+CORE_DEBUG_PROBE(1)
+CORE_DEBUG_PROBE(2)
+CORE_DEBUG_PROBE(3)
+CORE_DEBUG_PROBE(4)
+CORE_DEBUG_PROBE(5)
+CORE_DEBUG_PROBE(6)
+CORE_DEBUG_PROBE(7)
+CORE_DEBUG_PROBE(8)
+CORE_DEBUG_PROBE(9)
+CORE_DEBUG_PROBE(10)
+CORE_DEBUG_PROBE(11)
+CORE_DEBUG_PROBE(12)
+CORE_DEBUG_PROBE(13)
+CORE_DEBUG_PROBE(14)
+CORE_DEBUG_PROBE(15)
+
+template <int N> void discover_cores() {
+  core_debug debug;
+  if (core_debug_probe<VRiscVSystem, N>::probe(top, debug)) {
+    cores.push_back(debug);
+    discover_cores<N + 1>();
+  }
+}
+template <> void discover_cores<16>() {}
+
+// performance counters of one core, sampled at clock rise
+const size_t MAX_IQ_COUNT = 4;
+const size_t ISSUE_NUM = 2;
+struct core_stats {
+  uint64_t iq_empty_cycle_count[MAX_IQ_COUNT] = {};
+  uint64_t iq_full_cycle_count[MAX_IQ_COUNT] = {};
+  uint64_t issue_num_bounded_by_rob_size = 0;
+  uint64_t issue_num_bounded_by_lsq_size = 0;
+  uint64_t issue_num[ISSUE_NUM + 1] = {};
+  uint64_t retire_num[ISSUE_NUM + 1] = {};
+  uint64_t top_down[TOP_DOWN_COUNT] = {};
+};
+std::vector<core_stats> stats;
+// sampled cycles
+uint64_t cycles = 0;
+
+void accumulate_stats() {
+  for (size_t i = 0; i < cores.size(); i++) {
+    const core_debug &debug = cores[i];
+    core_stats &s = stats[i];
+    for (size_t j = 0; j < MAX_IQ_COUNT; j++) {
+      if ((*debug.iqEmptyMask >> j) & 1) {
+        s.iq_empty_cycle_count[j]++;
+      }
+      if ((*debug.iqFullMask >> j) & 1) {
+        s.iq_full_cycle_count[j]++;
+      }
+    }
+
+    if (*debug.issueNumBoundedByROBSize) {
+      s.issue_num_bounded_by_rob_size++;
+    }
+    if (*debug.issueNumBoundedByLSQSize) {
+      s.issue_num_bounded_by_lsq_size++;
+    }
+    s.issue_num[*debug.issueNum]++;
+    s.retire_num[*debug.retireNum]++;
+    for (size_t j = 0; j < TOP_DOWN_COUNT; j++) {
+      s.top_down[j] += *debug.topDown[j];
+    }
+  }
+  cycles++;
+}
+
+// sum of counters over all cores
+core_stats total_stats() {
+  core_stats total;
+  for (auto &s : stats) {
+    for (size_t i = 0; i < MAX_IQ_COUNT; i++) {
+      total.iq_empty_cycle_count[i] += s.iq_empty_cycle_count[i];
+      total.iq_full_cycle_count[i] += s.iq_full_cycle_count[i];
+    }
+    total.issue_num_bounded_by_rob_size += s.issue_num_bounded_by_rob_size;
+    total.issue_num_bounded_by_lsq_size += s.issue_num_bounded_by_lsq_size;
+    for (size_t i = 0; i <= ISSUE_NUM; i++) {
+      total.issue_num[i] += s.issue_num[i];
+      total.retire_num[i] += s.retire_num[i];
+    }
+    for (size_t i = 0; i < TOP_DOWN_COUNT; i++) {
+      total.top_down[i] += s.top_down[i];
+    }
+  }
+  return total;
+}
+
+uint64_t total_minstret() {
+  uint64_t minstret = 0;
+  for (auto &debug : cores) {
+    minstret += *debug.minstret;
+  }
+  return minstret;
+}
+
+// top-down counters in issue slots
+void write_top_down_json(JsonWriter &json, const uint64_t top_down[],
+                         uint64_t slots) {
+  json.begin_object("top_down");
+  json.value("slots", slots);
+  for (size_t i = 0; i < TOP_DOWN_COUNT; i++) {
+    json.value(top_down_names[i], top_down[i]);
+  }
+  json.end_object();
+}
+
+// one row per core, percentages are relative to sampled cycles
+void print_core_table() {
+  fprintf(stderr, "> Per core statistics:\n");
+  fprintf(stderr, "> %4s %12s %6s %7s %7s %7s %7s\n", "hart", "minstret",
+          "IPC", "issue0", "retire0", "ROB", "LSQ");
+  uint64_t min_minstret = ~0L;
+  uint64_t max_minstret = 0;
+  for (size_t i = 0; i < cores.size(); i++) {
+    const core_stats &s = stats[i];
+    uint64_t minstret = *cores[i].minstret;
+    fprintf(stderr,
+            "> %4ld %12ld %6.2lf %6.2lf%% %6.2lf%% %6.2lf%% %6.2lf%%\n", i,
+            minstret, (double)minstret / *cores[i].mcycle,
+            s.issue_num[0] * 100.0 / cycles, s.retire_num[0] * 100.0 / cycles,
+            s.issue_num_bounded_by_rob_size * 100.0 / cycles,
+            s.issue_num_bounded_by_lsq_size * 100.0 / cycles);
+    min_minstret = std::min(min_minstret, minstret);
+    max_minstret = std::max(max_minstret, minstret);
+  }
+  // 1.00 means perfectly balanced
+  if (total_minstret()) {
+    fprintf(stderr, "> Load imbalance (max/avg minstret): %.2lf\n",
+            max_minstret * (double)cores.size() / total_minstret());
+  }
+  fprintf(stderr, "> Min/max minstret: %ld/%ld\n", min_minstret,
+          max_minstret);
+}
+
+// pipeline counters in percent of core_cycles, prefix labels the lines
+void print_pipeline_stats(const char *prefix, const core_stats &s,
+                          uint64_t core_cycles) {
+  fprintf(stderr, "> %sIssue queue empty cycle:", prefix);
+  for (int i = 0; i < MAX_IQ_COUNT; i++) {
+    fprintf(stderr, " %.2lf%%",
+            s.iq_empty_cycle_count[i] * 100.0 / core_cycles);
+  }
+  fprintf(stderr, "\n");
+  fprintf(stderr, "> %sIssue queue full cycle:", prefix);
+  for (int i = 0; i < MAX_IQ_COUNT; i++) {
+    fprintf(stderr, " %.2lf%%", s.iq_full_cycle_count[i] * 100.0 / core_cycles);
+  }
+  fprintf(stderr, "\n");
+  fprintf(stderr,
+          "> %sCycles when issue num is bounded by ROB size: %.2lf%%\n",
+          prefix, s.issue_num_bounded_by_rob_size * 100.0 / core_cycles);
+  fprintf(stderr,
+          "> %sCycles when issue num is bounded by LSQ size: %.2lf%%\n",
+          prefix, s.issue_num_bounded_by_lsq_size * 100.0 / core_cycles);
+
+  fprintf(stderr, "> %sIssue num:", prefix);
+  for (int i = 0; i <= ISSUE_NUM; i++) {
+    fprintf(stderr, " %d=%.2lf%%", i, s.issue_num[i] * 100.0 / core_cycles);
+  }
+  fprintf(stderr, "\n");
+
+  fprintf(stderr, "> %sRetire num:", prefix);
+  for (int i = 0; i <= ISSUE_NUM; i++) {
+    fprintf(stderr, " %d=%.2lf%%", i, s.retire_num[i] * 100.0 / core_cycles);
+  }
+  fprintf(stderr, "\n");
+
+  // percentages of issue slots
+  uint64_t slots = core_cycles * ISSUE_NUM;
+  if (slots) {
+    fprintf(stderr,
+            "> %sTop-down: frontend %.2lf%% (I$ %.2lf%%, redirect "
+            "%.2lf%%), bad speculation %.2lf%%\n",
+            prefix, s.top_down[0] * 100.0 / slots,
+            s.top_down[5] * 100.0 / slots, s.top_down[6] * 100.0 / slots,
+            s.top_down[1] * 100.0 / slots);
+    fprintf(stderr,
+            "> %sTop-down: backend memory %.2lf%%, backend core "
+            "%.2lf%%, retiring %.2lf%%\n",
+            prefix, s.top_down[2] * 100.0 / slots,
+            s.top_down[3] * 100.0 / slots, s.top_down[4] * 100.0 / slots);
+  }
+}
+
+// sampling profiler
+// every profile_interval cycles, sample retire pc and stall category of each
+// core, symbolize at the end and write folded stacks for flamegraph.pl
+uint64_t profile_interval = 0;
+enum stall_category {
+  STALL_RETIRING,
+  STALL_ROB_FULL,
+  STALL_LSQ_FULL,
+  STALL_IQ_FULL,
+  STALL_FRONTEND,
+  STALL_BACKEND,
+};
+const char *stall_category_names[] = {"retiring", "rob_full", "lsq_full",
+                                      "iq_full",  "frontend", "backend"};
+// (hart, pc, category) -> samples
+std::map<std::tuple<size_t, uint64_t, int>, uint64_t> profile_samples;
+
+stall_category get_stall_category(const core_debug &debug) {
+  if (*debug.retireNum > 0) {
+    return STALL_RETIRING;
+  } else if (*debug.issueNumBoundedByROBSize) {
+    return STALL_ROB_FULL;
+  } else if (*debug.issueNumBoundedByLSQSize) {
+    return STALL_LSQ_FULL;
+  } else if (*debug.iqFullMask) {
+    return STALL_IQ_FULL;
+  } else if (*debug.issueNum == 0) {
+    // nothing to issue, waiting for instruction fetch
+    return STALL_FRONTEND;
+  } else {
+    // issuing but waiting for execution to complete
+    return STALL_BACKEND;
+  }
+}
+
+void profile_step() {
+  for (size_t i = 0; i < cores.size(); i++) {
+    profile_samples[std::make_tuple(i, *cores[i].pc,
+                                    get_stall_category(cores[i]))]++;
+  }
+}
+
+void write_profile(const char *path, Symbolizer &symbolizer) {
+  // hart;function;category -> samples
+  std::map<std::string, uint64_t> folded;
+  for (auto &it : profile_samples) {
+    size_t hart = std::get<0>(it.first);
+    uint64_t pc = std::get<1>(it.first);
+    int category = std::get<2>(it.first);
+    const char *name = symbolizer.lookup(pc);
+    char buffer[64];
+    if (!name) {
+      snprintf(buffer, sizeof(buffer), "0x%lx", pc);
+      name = buffer;
+    }
+    std::string stack = "hart" + std::to_string(hart) + ";" + name + ";" +
+                        stall_category_names[category];
+    folded[stack] += it.second;
+  }
+
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    fprintf(stderr, "> Failed to open %s\n", path);
+    return;
+  }
+  uint64_t total = 0;
+  for (auto &it : folded) {
+    fprintf(fp, "%s %ld\n", it.first.c_str(), it.second);
+    total += it.second;
+  }
+  fclose(fp);
+  fprintf(stderr, "> Wrote %ld profile samples to %s\n", total, path);
+}
+
+// binary retire trace
+RetireTraceWriter retire_trace_writer;
+bool retire_trace_enabled = false;
+
+void retire_trace_step() {
+  for (size_t i = 0; i < cores.size(); i++) {
+    for (size_t j = 0; j < RETIRE_NUM; j++) {
+      const retire_trace &trace = cores[i].retire[j];
+      if (!*trace.valid) {
+        continue;
+      }
+      retire_record record;
+      record.hart = i;
+      record.pc = *trace.pc;
+      record.instr = *trace.instr;
+      record.cycle = *cores[i].mcycle;
+      record.rd_kind = *trace.wen ? (*trace.rdFloat ? 2 : 1) : 0;
+      record.rd = *trace.rd;
+      record.rd_value = *trace.wdata;
+      record.store = *trace.store;
+      record.store_addr = *trace.storeAddr;
+      record.store_data = *trace.storeData;
+      record.store_be = *trace.storeBe;
+      retire_trace_writer.write(record);
+    }
+  }
+}
+
+// architectural registers seen in the retire trace, kept while saving a
+// checkpoint so that cosim can resume from it
+struct arch_regs {
+  uint64_t xpr[32] = {};
+  uint64_t fpr[32] = {};
+};
+std::vector<arch_regs> shadow_regs;
+bool shadow_regs_enabled = false;
+
+void shadow_regs_step() {
+  for (size_t i = 0; i < cores.size(); i++) {
+    for (size_t j = 0; j < RETIRE_NUM; j++) {
+      const retire_trace &trace = cores[i].retire[j];
+      if (!*trace.valid || !*trace.wen) {
+        continue;
+      }
+      if (*trace.rdFloat) {
+        shadow_regs[i].fpr[*trace.rd] = *trace.wdata;
+      } else {
+        shadow_regs[i].xpr[*trace.rd] = *trace.wdata;
+      }
+    }
+  }
+}
+
+#ifdef COSIM
+// compare retired instructions of all cores against spike
+bool cosim = false;
+
+void cosim_step() {
+  for (size_t i = 0; i < cores.size(); i++) {
+    for (size_t j = 0; j < RETIRE_NUM; j++) {
+      const retire_trace &trace = cores[i].retire[j];
+      if (!*trace.valid) {
+        continue;
+      }
+      cosim_retire retire;
+      retire.pc = *trace.pc;
+      retire.instr = *trace.instr;
+      retire.wen = *trace.wen;
+      retire.rd_float = *trace.rdFloat;
+      retire.rd = *trace.rd;
+      retire.wdata = *trace.wdata;
+      retire.store = *trace.store;
+      retire.store_addr = *trace.storeAddr;
+      retire.store_data = *trace.storeData;
+      retire.store_be = *trace.storeBe;
+      if (!cosim_check(i, retire)) {
+        finished = true;
+        res = 1;
+        return;
+      }
+    }
+  }
+}
+#endif
+
+// core is spinning in one of park functions
+bool core_parked(const core_debug &debug) {
+  for (auto &range : park_ranges) {
+    if (range.first <= *debug.pc && *debug.pc < range.second) {
+      return true;
+    }
+  }
+  return false;
+}
+
 struct axi_read_request {
   uint64_t read_id;
   uint64_t read_addr;
   uint64_t read_len;
   uint64_t read_size;
-  uint64_t dram_read_bytes;
-  bool dram_pending;
   bool ready;
+  // ideal memory: first beat is available at this time
+  uint64_t ready_time;
+  // main_time of AR handshake
+  uint64_t start_time;
+  // dram sim: next burst to issue, end of bursts and bursts in flight
+  uint64_t dram_read_addr;
+  uint64_t dram_read_end;
+  uint64_t dram_pending;
+};
+
+struct axi_write_request {
+  uint64_t write_id;
+  uint64_t write_addr;
+  uint64_t write_len;
+  uint64_t write_size;
+  // all W beats are received
+  bool data_done;
+  bool ready;
+  // ideal memory: B is available at this time
+  uint64_t ready_time;
+  // main_time of AW handshake
+  uint64_t start_time;
+  // dram sim: next burst to issue, end of bursts and bursts in flight
+  uint64_t dram_write_addr;
+  uint64_t dram_write_end;
+  uint64_t dram_pending;
 };
 
 const int MAX_ID = 64;
 std::deque<axi_read_request *> axi_read_requests[MAX_ID];
+// waiting for B, per AWID
+std::deque<axi_write_request *> axi_write_requests[MAX_ID];
+// waiting for W beats, in AW order
+std::deque<axi_write_request *> axi_write_data_requests;
+// round robin arbitration of R and B between ids
+int last_read_request_queue = 0;
+int last_write_request_queue = 0;
+
+// ideal memory model
+// fixed latency in cycles from AR/AW handshake to first R beat/B
+uint64_t ideal_latency = 0;
+// max outstanding reads and writes
+uint64_t ideal_max_outstanding = 1;
+uint64_t read_outstanding = 0;
+uint64_t write_outstanding = 0;
+
+// bytes per dram transaction
+uint64_t dram_burst_bytes() {
+  return dram_system->GetBurstLength() * dram_system->GetBusBits() / 8;
+}
 
 void read_callback(uint64_t addr, void *user_data) {
   axi_read_request *req = (axi_read_request *)user_data;
-  req->dram_read_bytes +=
-      dram_system->GetBurstLength() * dram_system->GetBusBits() / 8;
-  req->dram_pending = false;
+  assert(req->dram_pending > 0);
+  req->dram_pending--;
 }
 
-void write_callback(uint64_t addr, void *user_data) { assert(0); }
+void write_callback(uint64_t addr, void *user_data) {
+  axi_write_request *req = (axi_write_request *)user_data;
+  assert(req->dram_pending > 0);
+  req->dram_pending--;
+}
+
+// dramsim3 on its own host thread
+// ticks of one cycle are handed over after step_mem() and run while the model
+// evaluates the next clock edges, dram_sync() waits for them before dram state
+// is accessed again, so simulated timing is identical to inline ticking
+bool dram_thread = false;
+std::thread dram_worker;
+std::atomic<uint64_t> dram_ticks_requested(0);
+std::atomic<uint64_t> dram_ticks_done(0);
+std::atomic<bool> dram_worker_exit(false);
+
+// busy wait hint, handover happens every cycle so sleeping is too slow
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// polls without work before the worker starts yielding its core, covers the
+// gap between two handovers but not e.g. a blocking gdb session
+const int DRAM_WORKER_SPIN = 4096;
+
+void dram_worker_loop() {
+  uint64_t done = 0;
+  int idle = 0;
+  while (true) {
+    uint64_t requested = dram_ticks_requested.load(std::memory_order_acquire);
+    if (done < requested) {
+      for (; done < requested; done++) {
+        dram_system->ClockTick();
+      }
+      dram_ticks_done.store(done, std::memory_order_release);
+      idle = 0;
+    } else if (dram_worker_exit.load(std::memory_order_acquire)) {
+      return;
+    } else if (idle < DRAM_WORKER_SPIN) {
+      idle++;
+      cpu_relax();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+// idle cycles are ticked one by one as well: the bundled dramsim3 has no way
+// to advance its clock in bulk, and skipping ticks would desync refresh
+void dram_tick(uint64_t ticks) {
+  if (dram_thread) {
+    dram_ticks_requested.fetch_add(ticks, std::memory_order_release);
+  } else {
+    for (uint64_t i = 0; i < ticks; i++) {
+      dram_system->ClockTick();
+    }
+  }
+}
+
+// wait for ticks in flight, callbacks have run when this returns
+void dram_sync() {
+  if (dram_thread) {
+    uint64_t requested = dram_ticks_requested.load(std::memory_order_relaxed);
+    while (dram_ticks_done.load(std::memory_order_acquire) < requested) {
+      cpu_relax();
+    }
+  }
+}
+
+void dram_thread_start() {
+  dram_worker = std::thread(dram_worker_loop);
+}
+
+void dram_thread_stop() {
+  if (dram_thread) {
+    dram_sync();
+    dram_worker_exit.store(true, std::memory_order_release);
+    dram_worker.join();
+    dram_thread = false;
+  }
+}
+
+// reads must not overtake writes of the same id in dram sim
+bool has_unissued_write(int id) {
+  for (axi_write_request *req : axi_write_requests[id]) {
+    if (req->dram_write_addr < req->dram_write_end) {
+      return true;
+    }
+  }
+  return false;
+}
 
 uint64_t memory_read_bytes = 0;
 uint64_t memory_write_bytes = 0;
 
+// latency from AR/AW handshake to last R beat/B handshake in cycles
+Histogram read_latency;
+Histogram write_latency;
+// outstanding requests sampled every cycle
+Histogram read_occupancy;
+Histogram write_occupancy;
+// bytes transferred on R/W channel per mem_bucket_cycles cycles
+uint64_t mem_bucket_cycles = 10000;
+std::vector<uint64_t> read_bucket_bytes;
+std::vector<uint64_t> write_bucket_bytes;
+
+void count_bucket_bytes(std::vector<uint64_t> &buckets, uint64_t bytes) {
+  uint64_t bucket = main_time / 10 / mem_bucket_cycles;
+  if (bucket >= buckets.size()) {
+    buckets.resize(bucket + 1);
+  }
+  buckets[bucket] += bytes;
+}
+
 // step per clock fall
 void step_mem() {
+  read_occupancy.add(read_outstanding);
+  write_occupancy.add(write_outstanding);
+
   // handle read
   if (dram) {
     // dram sim
+    dram_sync();
     top->mem_axi4_ARREADY = 0;
     if (top->mem_axi4_ARVALID) {
       if (dram_system->WillAcceptTransaction(top->mem_axi4_ARADDR, false)) {
@@ -157,265 +888,260 @@ void step_mem() {
         new_req->read_addr = top->mem_axi4_ARADDR;
         new_req->read_len = top->mem_axi4_ARLEN;
         new_req->read_size = top->mem_axi4_ARSIZE;
-        new_req->dram_read_bytes = 0;
-        new_req->dram_pending = true;
         new_req->ready = false;
+        new_req->start_time = main_time;
+        // split into dram bursts, the first one is issued right away
+        uint64_t burst = dram_burst_bytes();
+        uint64_t end = top->mem_axi4_ARADDR +
+                       (1 << top->mem_axi4_ARSIZE) * (1 + top->mem_axi4_ARLEN);
+        new_req->dram_read_addr = top->mem_axi4_ARADDR / burst * burst;
+        new_req->dram_read_end = (end + burst - 1) / burst * burst;
+        new_req->dram_pending = 0;
+        if (!has_unissued_write(new_req->read_id)) {
+          dram_system->AddTransaction(new_req->dram_read_addr, false, new_req);
+          new_req->dram_read_addr += burst;
+          new_req->dram_pending++;
+        }
         axi_read_requests[top->mem_axi4_ARID].push_back(new_req);
-        dram_system->AddTransaction(top->mem_axi4_ARADDR, false, new_req);
         memory_read_bytes +=
             (1 << top->mem_axi4_ARSIZE) * (1 + top->mem_axi4_ARLEN);
+        read_outstanding++;
       }
     }
 
-    // find not ready req but need more dram transactions
+    // issue one more dram burst per request per cycle, every request of an
+    // id is in flight at once and only R beats are kept in AR order
+    uint64_t burst = dram_burst_bytes();
     for (int i = 0; i < MAX_ID; i++) {
-      if (!axi_read_requests[i].empty()) {
-        axi_read_request *req = *axi_read_requests[i].begin();
-        if (!req->ready && !req->dram_pending) {
-          if (req->dram_read_bytes >=
-              (1 << req->read_size) * (1 + req->read_len)) {
-            // done
-            req->ready = true;
-          } else {
-            // try more
-            uint64_t addr = req->read_addr + req->dram_read_bytes;
-            if (dram_system->WillAcceptTransaction(addr, false)) {
-              dram_system->AddTransaction(addr, false, req);
-            }
-          }
+      if (has_unissued_write(i)) {
+        continue;
+      }
+      for (axi_read_request *req : axi_read_requests[i]) {
+        if (req->dram_read_addr < req->dram_read_end &&
+            dram_system->WillAcceptTransaction(req->dram_read_addr, false)) {
+          dram_system->AddTransaction(req->dram_read_addr, false, req);
+          req->dram_read_addr += burst;
+          req->dram_pending++;
+        }
+        if (!req->ready && req->dram_read_addr >= req->dram_read_end &&
+            req->dram_pending == 0) {
+          req->ready = true;
         }
       }
     }
+  } else {
+    // ideal memory
+    top->mem_axi4_ARREADY = 0;
+    if (top->mem_axi4_ARVALID && read_outstanding < ideal_max_outstanding) {
+      top->mem_axi4_ARREADY = 1;
+      axi_read_request *new_req = new axi_read_request;
+      new_req->read_id = top->mem_axi4_ARID;
+      new_req->read_addr = top->mem_axi4_ARADDR;
+      new_req->read_len = top->mem_axi4_ARLEN;
+      new_req->read_size = top->mem_axi4_ARSIZE;
+      new_req->ready = false;
+      // handshake completes at next clock rise
+      new_req->ready_time = main_time + 5 + ideal_latency * 10;
+      new_req->start_time = main_time;
+      axi_read_requests[top->mem_axi4_ARID].push_back(new_req);
+      memory_read_bytes +=
+          (1 << top->mem_axi4_ARSIZE) * (1 + top->mem_axi4_ARLEN);
+      read_outstanding++;
+    }
 
-    // find ready req
-    top->mem_axi4_RVALID = 0;
-    top->mem_axi4_RID = 0;
-    top->mem_axi4_RLAST = 0;
-    memset(top->mem_axi4_RDATA, 0, sizeof(top->mem_axi4_RDATA));
     for (int i = 0; i < MAX_ID; i++) {
-      // round robin and keep sending the same RID
-      static int last_read_request_queue = 0;
-      int index = (i + last_read_request_queue) % MAX_ID;
-      if (!axi_read_requests[index].empty() &&
-          (*axi_read_requests[index].begin())->ready) {
-        last_read_request_queue = index;
-
-        axi_read_request *req = *axi_read_requests[index].begin();
-        top->mem_axi4_RVALID = 1;
-        top->mem_axi4_RID = req->read_id;
-        mpz_class r_data;
-
-        uint64_t aligned =
-            (req->read_addr / MEM_AXI_DATA_BYTES) * MEM_AXI_DATA_BYTES;
-        for (int i = 0; i < MEM_AXI_DATA_BYTES / sizeof(mem_t); i++) {
-          uint64_t addr = aligned + i * sizeof(mem_t);
-          mem_t r = memory[addr];
-          mpz_class res = r;
-          res <<= (i * (sizeof(mem_t) * 8));
-          r_data += res;
-        }
-
-        mpz_class mask = 1;
-        mask <<= (1L << req->read_size) * 8;
-        mask -= 1;
-
-        mpz_class shifted_mask =
-            mask << ((req->read_addr & (MEM_AXI_DATA_BYTES - 1)) * 8);
-        r_data &= shifted_mask;
-
-        // top->mem_axi4_RDATA = r_data & shifted_mask;
-        memset(top->mem_axi4_RDATA, 0, sizeof(top->mem_axi4_RDATA));
-        mpz_export(top->mem_axi4_RDATA, NULL, -1, 4, -1, 0, r_data.get_mpz_t());
-        top->mem_axi4_RLAST = req->read_len == 0;
-
-        // RREADY might be stale without eval()
-        top->eval();
-        if (top->mem_axi4_RREADY) {
-          if (req->read_len == 0) {
-            axi_read_requests[index].pop_front();
-            // round robin
-            last_read_request_queue = (index + 1) % MAX_ID;
-          } else {
-            req->read_addr += 1 << req->read_size;
-            req->read_len--;
-          }
+      if (!axi_read_requests[i].empty()) {
+        axi_read_request *req = *axi_read_requests[i].begin();
+        if (!req->ready && main_time >= req->ready_time) {
+          req->ready = true;
         }
-        break;
       }
     }
-  } else {
-    // non-dram sim
-    static bool pending_read = false;
-    static uint64_t pending_read_id = 0;
-    static uint64_t pending_read_addr = 0;
-    static uint64_t pending_read_len = 0;
-    static uint64_t pending_read_size = 0;
-
-    if (!pending_read) {
-      if (top->mem_axi4_ARVALID) {
-        top->mem_axi4_ARREADY = 1;
-        pending_read = true;
-        pending_read_id = top->mem_axi4_ARID;
-        pending_read_addr = top->mem_axi4_ARADDR;
-        pending_read_len = top->mem_axi4_ARLEN;
-        pending_read_size = top->mem_axi4_ARSIZE;
-        memory_read_bytes +=
-            (1 << top->mem_axi4_ARSIZE) * (1 + top->mem_axi4_ARLEN);
-      }
-
-      top->mem_axi4_RVALID = 0;
-    } else {
-      top->mem_axi4_ARREADY = 0;
+  }
 
+  // find ready req
+  top->mem_axi4_RVALID = 0;
+  top->mem_axi4_RID = 0;
+  top->mem_axi4_RLAST = 0;
+  memset(top->mem_axi4_RDATA, 0, sizeof(top->mem_axi4_RDATA));
+  for (int i = 0; i < MAX_ID; i++) {
+    // round robin and keep sending the same RID
+    int index = (i + last_read_request_queue) % MAX_ID;
+    if (!axi_read_requests[index].empty() &&
+        (*axi_read_requests[index].begin())->ready) {
+      last_read_request_queue = index;
+
+      axi_read_request *req = *axi_read_requests[index].begin();
       top->mem_axi4_RVALID = 1;
-      top->mem_axi4_RID = pending_read_id;
-      mpz_class r_data;
-
-      uint64_t aligned =
-          (pending_read_addr / MEM_AXI_DATA_BYTES) * MEM_AXI_DATA_BYTES;
-      for (int i = 0; i < MEM_AXI_DATA_BYTES / sizeof(mem_t); i++) {
-        uint64_t addr = aligned + i * sizeof(mem_t);
-        mem_t r = memory[addr];
-        mpz_class res = r;
-        res <<= (i * (sizeof(mem_t) * 8));
-        r_data += res;
-      }
-
-      mpz_class mask = 1;
-      mask <<= (1L << pending_read_size) * 8;
-      mask -= 1;
-
-      mpz_class shifted_mask =
-          mask << ((pending_read_addr & (MEM_AXI_DATA_BYTES - 1)) * 8);
-      r_data &= shifted_mask;
-
-      // top->mem_axi4_RDATA = r_data & shifted_mask;
-      memset(top->mem_axi4_RDATA, 0, sizeof(top->mem_axi4_RDATA));
-      mpz_export(top->mem_axi4_RDATA, NULL, -1, 4, -1, 0, r_data.get_mpz_t());
-      top->mem_axi4_RLAST = pending_read_len == 0;
+      top->mem_axi4_RID = req->read_id;
+      axi_beat<MEM_AXI_DATA_WIDTH> r_data;
+      r_data.load(memory, req->read_addr);
+      r_data.mask(r_data.size_strb(req->read_addr, req->read_size));
+      r_data.to_signal(top->mem_axi4_RDATA);
+      top->mem_axi4_RLAST = req->read_len == 0;
 
       // RREADY might be stale without eval()
       top->eval();
       if (top->mem_axi4_RREADY) {
-        if (pending_read_len == 0) {
-          pending_read = false;
+        count_bucket_bytes(read_bucket_bytes, 1L << req->read_size);
+        if (req->read_len == 0) {
+          read_latency.add((main_time - req->start_time) / 10);
+          axi_read_requests[index].pop_front();
+          delete req;
+          read_outstanding--;
+          // round robin
+          last_read_request_queue = (index + 1) % MAX_ID;
         } else {
-          pending_read_addr += 1 << pending_read_size;
-          pending_read_len--;
+          req->read_addr += 1 << req->read_size;
+          req->read_len--;
         }
       }
+      break;
     }
   }
 
   // handle write
-  static bool pending_write = false;
-  static bool pending_write_finished = false;
-  static uint64_t pending_write_addr = 0;
-  static uint64_t pending_write_len = 0;
-  static uint64_t pending_write_size = 0;
-  static uint64_t pending_write_id = 0;
-  if (!pending_write) {
-    // idle
-    if (top->mem_axi4_AWVALID) {
-      top->mem_axi4_AWREADY = 1;
-      pending_write = true;
-      pending_write_addr = top->mem_axi4_AWADDR;
-      pending_write_len = top->mem_axi4_AWLEN;
-      pending_write_size = top->mem_axi4_AWSIZE;
-      pending_write_id = top->mem_axi4_AWID;
-      pending_write_finished = false;
-      memory_write_bytes +=
-          (1 << top->mem_axi4_AWSIZE) * (1 + top->mem_axi4_AWLEN);
+  if (dram) {
+    // issue one dram burst per request per cycle once its data has arrived
+    // keep AW order within the same id
+    uint64_t burst = dram_burst_bytes();
+    for (int i = 0; i < MAX_ID; i++) {
+      for (axi_write_request *req : axi_write_requests[i]) {
+        bool data_arrived = req->data_done ||
+                            req->dram_write_addr + burst <= req->write_addr;
+        if (req->dram_write_addr < req->dram_write_end && data_arrived &&
+            dram_system->WillAcceptTransaction(req->dram_write_addr, true)) {
+          dram_system->AddTransaction(req->dram_write_addr, true, req);
+          req->dram_write_addr += burst;
+          req->dram_pending++;
+        }
+        if (!req->ready && req->data_done &&
+            req->dram_write_addr >= req->dram_write_end &&
+            req->dram_pending == 0) {
+          req->ready = true;
+        }
+        if (req->dram_write_addr < req->dram_write_end) {
+          break;
+        }
+      }
     }
-    top->mem_axi4_WREADY = 0;
-    top->mem_axi4_BVALID = 0;
-  } else if (!pending_write_finished) {
-    // writing
-    top->mem_axi4_AWREADY = 0;
+  } else {
+    for (int i = 0; i < MAX_ID; i++) {
+      if (!axi_write_requests[i].empty()) {
+        axi_write_request *req = *axi_write_requests[i].begin();
+        if (req->data_done && main_time >= req->ready_time) {
+          req->ready = true;
+        }
+      }
+    }
+  }
+
+  // B response first, then W, then AW, so that W beats are only accepted for
+  // write requests whose AW handshake has completed
+  top->mem_axi4_BVALID = 0;
+  top->mem_axi4_BID = 0;
+  for (int i = 0; i < MAX_ID; i++) {
+    int index = (i + last_write_request_queue) % MAX_ID;
+    if (!axi_write_requests[index].empty()) {
+      axi_write_request *req = *axi_write_requests[index].begin();
+      if (req->ready) {
+        top->mem_axi4_BVALID = 1;
+        top->mem_axi4_BRESP = 0;
+        top->mem_axi4_BID = req->write_id;
+
+        // BREADY might be stale without eval()
+        top->eval();
+        if (top->mem_axi4_BREADY) {
+          write_latency.add((main_time - req->start_time) / 10);
+          axi_write_requests[index].pop_front();
+          delete req;
+          write_outstanding--;
+          // round robin
+          last_write_request_queue = (index + 1) % MAX_ID;
+        }
+        break;
+      }
+    }
+  }
+
+  top->mem_axi4_WREADY = 0;
+  if (!axi_write_data_requests.empty()) {
+    axi_write_request *req = axi_write_data_requests.front();
     top->mem_axi4_WREADY = 1;
 
     // WVALID might be stale without eval()
     top->eval();
     if (top->mem_axi4_WVALID) {
-      mpz_class mask = 1;
-      mask <<= 1L << pending_write_size;
-      mask -= 1;
-
-      mpz_class shifted_mask =
-          mask << (pending_write_addr & (MEM_AXI_DATA_BYTES - 1));
-      mpz_class wdata;
-      mpz_import(wdata.get_mpz_t(), MEM_AXI_DATA_BYTES / 4, -1, 4, -1, 0,
-                 top->mem_axi4_WDATA);
-
-      uint64_t aligned =
-          pending_write_addr / MEM_AXI_DATA_BYTES * MEM_AXI_DATA_BYTES;
-      for (int i = 0; i < MEM_AXI_DATA_BYTES / sizeof(mem_t); i++) {
-        uint64_t addr = aligned + i * sizeof(mem_t);
-
-        mpz_class local_wdata_mpz = wdata >> (i * (sizeof(mem_t) * 8));
-        mem_t local_wdata = local_wdata_mpz.get_ui();
-
-        uint64_t local_wstrb =
-            (top->mem_axi4_WSTRB >> (i * sizeof(mem_t))) & 0xfL;
-
-        mpz_class local_mask_mpz = shifted_mask >> (i * sizeof(mem_t));
-        uint64_t local_mask = local_mask_mpz.get_ui() & 0xfL;
-        if (local_mask & local_wstrb) {
-          mem_t base = memory[addr];
-          mem_t input = local_wdata;
-          uint64_t be = local_mask & local_wstrb;
-
-          mem_t muxed = 0;
-          for (int i = 0; i < sizeof(mem_t); i++) {
-            mem_t sel;
-            if (((be >> i) & 1) == 1) {
-              sel = (input >> (i * 8)) & 0xff;
-            } else {
-              sel = (base >> (i * 8)) & 0xff;
-            }
-            muxed |= (sel << (i * 8));
-          }
-
-          memory[addr] = muxed;
-        }
-      }
-
-      uint64_t input = wdata.get_ui();
-      pending_write_addr += 1L << pending_write_size;
-      pending_write_len--;
+      axi_beat<MEM_AXI_DATA_WIDTH> wdata;
+      wdata.from_signal(top->mem_axi4_WDATA);
+      wdata.store(memory, req->write_addr,
+                  wdata.size_strb(req->write_addr, req->write_size) &
+                      top->mem_axi4_WSTRB);
+      trace_check_write(req->write_addr, req->write_size);
+      count_bucket_bytes(write_bucket_bytes, 1L << req->write_size);
+
+      req->write_addr += 1L << req->write_size;
+      req->write_len--;
       if (top->mem_axi4_WLAST) {
-        assert(pending_write_len == -1);
-        pending_write_finished = true;
+        assert(req->write_len == -1);
+        req->data_done = true;
+        // handshake completes at next clock rise
+        req->ready_time = main_time + 5 + ideal_latency * 10;
+        axi_write_data_requests.pop_front();
       }
     }
+  }
 
-    top->mem_axi4_BVALID = 0;
-  } else {
-    // finishing
-    top->mem_axi4_AWREADY = 0;
-    top->mem_axi4_WREADY = 0;
-    top->mem_axi4_BVALID = 1;
-    top->mem_axi4_BRESP = 0;
-    top->mem_axi4_BID = pending_write_id;
-
-    // BREADY might be stale without eval()
-    top->eval();
-    if (top->mem_axi4_BREADY) {
-      pending_write = false;
-      pending_write_finished = false;
+  top->mem_axi4_AWREADY = 0;
+  if (top->mem_axi4_AWVALID &&
+      (dram ? dram_system->WillAcceptTransaction(top->mem_axi4_AWADDR, true)
+            : write_outstanding < ideal_max_outstanding)) {
+    top->mem_axi4_AWREADY = 1;
+    axi_write_request *new_req = new axi_write_request;
+    new_req->write_id = top->mem_axi4_AWID;
+    new_req->write_addr = top->mem_axi4_AWADDR;
+    new_req->write_len = top->mem_axi4_AWLEN;
+    new_req->write_size = top->mem_axi4_AWSIZE;
+    new_req->data_done = false;
+    new_req->ready = false;
+    new_req->ready_time = 0;
+    new_req->start_time = main_time;
+    new_req->dram_write_addr = 0;
+    new_req->dram_write_end = 0;
+    new_req->dram_pending = 0;
+    if (dram) {
+      uint64_t burst = dram_burst_bytes();
+      uint64_t end = top->mem_axi4_AWADDR +
+                     (1 << top->mem_axi4_AWSIZE) * (1 + top->mem_axi4_AWLEN);
+      new_req->dram_write_addr = top->mem_axi4_AWADDR / burst * burst;
+      new_req->dram_write_end = (end + burst - 1) / burst * burst;
     }
+    axi_write_requests[top->mem_axi4_AWID].push_back(new_req);
+    axi_write_data_requests.push_back(new_req);
+    memory_write_bytes +=
+        (1 << top->mem_axi4_AWSIZE) * (1 + top->mem_axi4_AWLEN);
+    write_outstanding++;
   }
 }
 
+// mmio read or write in progress
+bool mmio_pending = false;
+// single outstanding mmio read and write
+bool pending_read = false;
+uint64_t pending_read_id = 0;
+uint64_t pending_read_addr = 0;
+uint64_t pending_read_len = 0;
+uint64_t pending_read_size = 0;
+bool pending_write = false;
+bool pending_write_finished = false;
+uint64_t pending_write_addr = 0;
+uint64_t pending_write_len = 0;
+uint64_t pending_write_size = 0;
+uint64_t pending_write_id = 0;
+
 // step per clock fall
 void step_mmio() {
   // handle read
-  static bool pending_read = false;
-  static uint64_t pending_read_id = 0;
-  static uint64_t pending_read_addr = 0;
-  static uint64_t pending_read_len = 0;
-  static uint64_t pending_read_size = 0;
-
   if (!pending_read) {
     if (top->mmio_axi4_ARVALID) {
       top->mmio_axi4_ARREADY = 1;
@@ -432,36 +1158,21 @@ void step_mmio() {
 
     top->mmio_axi4_RVALID = 1;
     top->mmio_axi4_RID = pending_read_id;
-    mpz_class r_data;
+    axi_beat<MMIO_AXI_DATA_WIDTH> r_data;
     if (pending_read_addr == serial_addr + 0x14 ||
         pending_read_addr == serial_fpga_addr + 0x14) {
       // serial lsr
       // THRE | TEMT
       uint64_t lsr = (1L << 5) | (1L << 6);
-      r_data = lsr << 32;
+      r_data.data[0] = lsr << 32;
+    } else if (pending_read_addr == console_addr) {
+      // console is always ready, report staging buffer
+      r_data.data[0] = (CONSOLE_BUFFER_SIZE << 48) | console_buffer_addr;
     } else {
-      uint64_t aligned =
-          (pending_read_addr / MMIO_AXI_DATA_BYTES) * MMIO_AXI_DATA_BYTES;
-      for (int i = 0; i < MMIO_AXI_DATA_BYTES / sizeof(mem_t); i++) {
-        uint64_t addr = aligned + i * sizeof(mem_t);
-        mem_t r = memory[addr];
-        mpz_class res = r;
-        res <<= (i * (sizeof(mem_t) * 8));
-        r_data += res;
-      }
+      r_data.load(memory, pending_read_addr);
     }
-
-    mpz_class mask = 1;
-    mask <<= (1L << pending_read_size) * 8;
-    mask -= 1;
-
-    mpz_class shifted_mask =
-        mask << ((pending_read_addr & (MMIO_AXI_DATA_BYTES - 1)) * 8);
-    r_data &= shifted_mask;
-
-    // top->mmio_axi4_RDATA = r_data & shifted_mask;
-    memset(&top->mmio_axi4_RDATA, 0, sizeof(top->mmio_axi4_RDATA));
-    mpz_export(&top->mmio_axi4_RDATA, NULL, -1, 4, -1, 0, r_data.get_mpz_t());
+    r_data.mask(r_data.size_strb(pending_read_addr, pending_read_size));
+    r_data.to_signal(&top->mmio_axi4_RDATA);
     top->mmio_axi4_RLAST = pending_read_len == 0;
 
     // RREADY might be stale without eval()
@@ -477,12 +1188,6 @@ void step_mmio() {
   }
 
   // handle write
-  static bool pending_write = false;
-  static bool pending_write_finished = false;
-  static uint64_t pending_write_addr = 0;
-  static uint64_t pending_write_len = 0;
-  static uint64_t pending_write_size = 0;
-  static uint64_t pending_write_id = 0;
   if (!pending_write) {
     if (top->mmio_axi4_AWVALID) {
       top->mmio_axi4_AWREADY = 1;
@@ -502,61 +1207,39 @@ void step_mmio() {
     // WVALID might be stale without eval()
     top->eval();
     if (top->mmio_axi4_WVALID) {
-      mpz_class mask = 1;
-      mask <<= 1L << pending_write_size;
-      mask -= 1;
-
-      mpz_class shifted_mask =
-          mask << (pending_write_addr & (MMIO_AXI_DATA_BYTES - 1));
-      mpz_class wdata;
-      mpz_import(wdata.get_mpz_t(), MMIO_AXI_DATA_BYTES / 4, -1, 4, -1, 0,
-                 &top->mmio_axi4_WDATA);
-
-      uint64_t aligned =
-          pending_write_addr / MMIO_AXI_DATA_BYTES * MMIO_AXI_DATA_BYTES;
-      for (int i = 0; i < MMIO_AXI_DATA_BYTES / sizeof(mem_t); i++) {
-        uint64_t addr = aligned + i * sizeof(mem_t);
-
-        mpz_class local_wdata_mpz = wdata >> (i * (sizeof(mem_t) * 8));
-        mem_t local_wdata = local_wdata_mpz.get_ui();
-
-        uint64_t local_wstrb =
-            (top->mmio_axi4_WSTRB >> (i * sizeof(mem_t))) & 0xfL;
-
-        mpz_class local_mask_mpz = shifted_mask >> (i * sizeof(mem_t));
-        uint64_t local_mask = local_mask_mpz.get_ui() & 0xfL;
-        if (local_mask & local_wstrb) {
-          mem_t base = memory[addr];
-          mem_t input = local_wdata;
-          uint64_t be = local_mask & local_wstrb;
-
-          mem_t muxed = 0;
-          for (int i = 0; i < sizeof(mem_t); i++) {
-            mem_t sel;
-            if (((be >> i) & 1) == 1) {
-              sel = (input >> (i * 8)) & 0xff;
-            } else {
-              sel = (base >> (i * 8)) & 0xff;
-            }
-            muxed |= (sel << (i * 8));
-          }
-
-          memory[addr] = muxed;
-        }
-      }
-
-      uint64_t input = wdata.get_ui();
+      axi_beat<MMIO_AXI_DATA_WIDTH> wdata;
+      wdata.from_signal(&top->mmio_axi4_WDATA);
+      wdata.store(memory, pending_write_addr,
+                  wdata.size_strb(pending_write_addr, pending_write_size) &
+                      top->mmio_axi4_WSTRB);
+
+      uint64_t input = wdata.data[0];
+      trace_check_write(pending_write_addr, pending_write_size);
       if (pending_write_addr == serial_addr ||
           pending_write_addr == serial_fpga_addr) {
         // serial
-        printf("%c", input & 0xFF);
-        fflush(stdout);
+        char ch = input & 0xFF;
+        console_write(&ch, 1);
+      } else if (pending_write_addr == console_addr) {
+        // console, print the line in place from the staging buffer
+        uint64_t addr = input & ((1L << 48) - 1);
+        uint64_t len = input >> 48;
+        uint64_t end = console_buffer_addr + CONSOLE_BUFFER_SIZE;
+        if (addr >= console_buffer_addr && addr < end) {
+          const char *page = (const char *)memory.get_page(console_buffer_addr);
+          console_write(page + (addr - console_buffer_addr),
+                        std::min(len, end - addr));
+        }
       } else if (pending_write_addr == tohost_addr) {
         // tohost
         uint32_t data = input & 0xFFFFFFFF;
+        if (trace_on_tohost && input == trace_tohost) {
+          trace_fire("tohost");
+        }
         if (input == ((data & 0xFF) | 0x0101000000000000L)) {
           // serial
-          printf("%c", input & 0xFF);
+          char ch = input & 0xFF;
+          console_write(&ch, 1);
         } else if (data == 1) {
           // pass
           fprintf(stderr, "> ISA testsuite pass\n");
@@ -578,7 +1261,7 @@ void step_mmio() {
         // clear tohost
         for (int i = 0; i < MMIO_AXI_DATA_BYTES / sizeof(mem_t); i++) {
           uint64_t addr = tohost_addr + i * sizeof(mem_t);
-          memory[addr] = 0;
+          memory.write(addr, 0);
         }
       }
 
@@ -606,66 +1289,70 @@ void step_mmio() {
       pending_write_finished = false;
     }
   }
+
+  mmio_pending = pending_read || pending_write;
 }
 
 // load file
+// elf symbols, indexed by name
+struct elf_symbol {
+  uint64_t addr;
+  uint64_t size;
+  // defined function or label, used to symbolize profile samples
+  bool code;
+};
+std::unordered_multimap<std::string, elf_symbol> symbols;
+
+// set addr to symbol address if it exists
+bool lookup_symbol(const char *name, uint64_t &addr) {
+  auto it = symbols.find(name);
+  if (it == symbols.end()) {
+    return false;
+  }
+  addr = it->second.addr;
+  return true;
+}
+
+// map whole file privately, writes to guest memory never reach the file
+// the mapping lives until exit
+uint8_t *map_file(const std::string &path, size_t &size) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "> Failed to open %s\n", path.c_str());
+    exit(1);
+  }
+  struct stat st = {};
+  fstat(fd, &st);
+  size = st.st_size;
+  void *buffer = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buffer == MAP_FAILED) {
+    fprintf(stderr, "> Failed to mmap %s\n", path.c_str());
+    exit(1);
+  }
+  return (uint8_t *)buffer;
+}
+
 void load_file(const std::string &path) {
   size_t i = path.rfind('.');
   std::string ext;
   if (i != std::string::npos) {
     ext = path.substr(i);
   }
+
+  size_t size;
+  uint8_t *buffer = map_file(path, size);
   if (ext == ".bin") {
     // load as bin
-    FILE *fp = fopen(path.c_str(), "rb");
-    assert(fp);
     uint64_t addr = 0x80000000;
-
-    // read whole file and pad to multiples of mem_t
-    fseek(fp, 0, SEEK_END);
-    size_t size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    size_t padded_size = align(size + sizeof(mem_t) - 1);
-    uint8_t *buffer = new uint8_t[padded_size];
-    memset(buffer, 0, padded_size);
-
-    size_t offset = 0;
-    while (!feof(fp)) {
-      ssize_t read = fread(&buffer[offset], 1, size - offset, fp);
-      if (read <= 0) {
-        break;
-      }
-      offset += read;
-    }
-
-    for (int i = 0; i < padded_size; i += sizeof(mem_t)) {
-      memory[addr + i] = *((mem_t *)&buffer[i]);
-    }
-    fprintf(stderr, "> Loaded %ld bytes from BIN %s\n", size, path.c_str());
-    fclose(fp);
-    delete[] buffer;
+    size_t pages = memory.map(addr, buffer, size);
+    fprintf(stderr, "> Loaded %ld bytes (%ld pages mapped) from BIN %s\n",
+            size, pages, path.c_str());
   } else {
     // load as elf
-
-    // read whole file
-    FILE *fp = fopen(path.c_str(), "rb");
-    assert(fp);
-    fseek(fp, 0, SEEK_END);
-    size_t size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    uint8_t *buffer = new uint8_t[size];
-    memset(buffer, 0, size);
-
-    size_t offset = 0;
-    while (!feof(fp)) {
-      ssize_t read = fread(&buffer[offset], 1, size - offset, fp);
-      if (read <= 0) {
-        break;
-      }
-      offset += read;
-    }
-
     Elf64_Ehdr *hdr = (Elf64_Ehdr *)buffer;
+    assert(size >= sizeof(Elf64_Ehdr));
     assert(hdr->e_ident[EI_MAG0] == ELFMAG0);
     assert(hdr->e_ident[EI_MAG1] == ELFMAG1);
     assert(hdr->e_ident[EI_MAG2] == ELFMAG2);
@@ -678,60 +1365,66 @@ void load_file(const std::string &path) {
     // https://github.com/eklitzke/parse-elf/blob/master/parse_elf.cc
     // iterate program header
     size_t total_size = 0;
+    size_t total_pages = 0;
     for (int i = 0; i < hdr->e_phnum; i++) {
-      size_t offset = hdr->e_phoff + i * hdr->e_phentsize;
-      Elf64_Phdr *hdr = (Elf64_Phdr *)&buffer[offset];
-      if (hdr->p_type == PT_LOAD) {
-        // load memory
-        size_t size = hdr->p_filesz;
-        size_t offset = hdr->p_offset;
-        size_t dest = hdr->p_paddr;
-        total_size += size;
-        for (int i = 0; i < size; i += sizeof(mem_t)) {
-          mem_t data = *(mem_t *)&buffer[offset + i];
-          memory[dest + i] = data;
+      Elf64_Phdr *phdr =
+          (Elf64_Phdr *)&buffer[hdr->e_phoff + i * hdr->e_phentsize];
+      if (phdr->p_type == PT_LOAD) {
+        // p_offset and p_vaddr are congruent modulo page size, so file pages
+        // can be mapped into guest memory in place
+        assert(phdr->p_offset + phdr->p_filesz <= size);
+        total_pages += memory.map(phdr->p_paddr, &buffer[phdr->p_offset],
+                                  phdr->p_filesz);
+        // .bss
+        if (phdr->p_memsz > phdr->p_filesz) {
+          memory.zero(phdr->p_paddr + phdr->p_filesz,
+                      phdr->p_memsz - phdr->p_filesz);
         }
+        total_size += phdr->p_filesz;
       }
     }
 
-    // find symbol table
-    uint64_t symbol_table_offset = 0;
-    uint64_t symbol_table_size = 0;
-    uint64_t string_table = 0;
+    // index symbol table, names live in its linked string table
+    Elf64_Shdr *shdrs = (Elf64_Shdr *)&buffer[hdr->e_shoff];
     for (int i = 0; i < hdr->e_shnum; i++) {
-      size_t offset = hdr->e_shoff + i * hdr->e_shentsize;
-      Elf64_Shdr *hdr = (Elf64_Shdr *)&buffer[offset];
-      if (hdr->sh_type == SHT_SYMTAB) {
-        symbol_table_offset = hdr->sh_offset;
-        symbol_table_size = hdr->sh_size;
-      } else if (hdr->sh_type == SHT_STRTAB) {
-        if (!string_table) {
-          string_table = hdr->sh_offset;
+      if (shdrs[i].sh_type != SHT_SYMTAB) {
+        continue;
+      }
+      Elf64_Sym *syms = (Elf64_Sym *)&buffer[shdrs[i].sh_offset];
+      const char *strtab =
+          (const char *)&buffer[shdrs[shdrs[i].sh_link].sh_offset];
+      size_t count = shdrs[i].sh_size / sizeof(Elf64_Sym);
+      symbols.reserve(symbols.size() + count);
+      for (size_t j = 0; j < count; j++) {
+        if (syms[j].st_name) {
+          int type = ELF64_ST_TYPE(syms[j].st_info);
+          bool code = syms[j].st_shndx != SHN_UNDEF &&
+                      (type == STT_FUNC || type == STT_NOTYPE);
+          symbols.insert(std::make_pair(
+              strtab + syms[j].st_name,
+              elf_symbol{syms[j].st_value, syms[j].st_size, code}));
         }
       }
     }
 
-    // iterate symbol table
-    for (int i = 0; i < symbol_table_size; i += sizeof(Elf64_Sym)) {
-      size_t offset = symbol_table_offset + i;
-      Elf64_Sym *symbol = (Elf64_Sym *)&buffer[offset];
-      std::string name = (char *)&buffer[string_table + symbol->st_name];
-      if (name == "tohost") {
-        tohost_addr = symbol->st_value;
-      } else if (name == "fromhost") {
-        fromhost_addr = symbol->st_value;
-      } else if (name == "begin_signature") {
-        begin_signature = symbol->st_value;
-      } else if (name == "begin_signature_override") {
-        begin_signature_override = symbol->st_value;
-      } else if (name == "end_signature") {
-        end_signature = symbol->st_value;
+    lookup_symbol("tohost", tohost_addr);
+    lookup_symbol("fromhost", fromhost_addr);
+    lookup_symbol("begin_signature", begin_signature);
+    lookup_symbol("begin_signature_override", begin_signature_override);
+    lookup_symbol("end_signature", end_signature);
+    for (auto &park_symbol : park_symbols) {
+      auto range = symbols.equal_range(park_symbol);
+      for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.size > 0) {
+          park_ranges.push_back(std::make_pair(
+              it->second.addr, it->second.addr + it->second.size));
+        }
       }
     }
 
-    fprintf(stderr, "> Loaded %ld bytes from ELF %s\n", size, path.c_str());
-    fclose(fp);
-    delete[] buffer;
+    fprintf(stderr,
+            "> Loaded %ld bytes (%ld pages mapped) from ELF %s, %ld symbols\n",
+            total_size, total_pages, path.c_str(), symbols.size());
   }
   fprintf(stderr, "> Using tohost at %x\n", tohost_addr);
   fprintf(stderr, "> Using fromhost at %x\n", fromhost_addr);
@@ -746,6 +1439,33 @@ uint64_t get_time_us() {
 int listen_fd = -1;
 int client_fd = -1;
 
+// no memory or mmio transaction in flight, including dramsim3
+bool bus_idle() {
+  if (read_outstanding || write_outstanding || top->mem_axi4_ARVALID ||
+      top->mem_axi4_AWVALID || top->mem_axi4_WVALID) {
+    return false;
+  }
+  if (mmio_pending || top->mmio_axi4_ARVALID || top->mmio_axi4_AWVALID ||
+      top->mmio_axi4_WVALID) {
+    return false;
+  }
+  return true;
+}
+
+// no hart can make progress: all harts are parked with interrupts disabled,
+// and there is no pending memory, mmio or jtag activity
+bool system_idle() {
+  if (jtag || gdb_port || park_ranges.empty()) {
+    return false;
+  }
+  for (auto &core : cores) {
+    if (*core.intEnabled || !core_parked(core)) {
+      return false;
+    }
+  }
+  return bus_idle();
+}
+
 int jtag_rbb_init() {
   // ref rocket chip remote_bitbang.cc
   listen_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -784,70 +1504,140 @@ int jtag_rbb_init() {
   return 0;
 }
 
+// remote bitbang commands are applied in batches of up to jtag_rbb_batch
+// tck rising edges per half cycle, 0 applies one command per half cycle so
+// traces see every edge
+uint64_t jtag_rbb_batch = 8;
+// half cycles between accept() while detached
+const uint64_t JTAG_RBB_ACCEPT_INTERVAL = 1 << 14;
+// upper bound of half cycles between read() while the debugger is quiet
+const uint64_t JTAG_RBB_MAX_POLL_INTERVAL = 1 << 10;
+
+char jtag_rbb_rx[4096];
+size_t jtag_rbb_rx_count = 0;
+size_t jtag_rbb_rx_offset = 0;
+// tdo replies not yet sent
+std::vector<char> jtag_rbb_tx;
+uint64_t jtag_rbb_poll_interval = 0;
+uint64_t jtag_rbb_poll_wait = 0;
+
+void jtag_rbb_detach() {
+  fprintf(stderr, "> JTAG debugger detached\n");
+  close(client_fd);
+  client_fd = -1;
+  jtag_rbb_rx_count = jtag_rbb_rx_offset = 0;
+  jtag_rbb_tx.clear();
+  jtag_rbb_poll_wait = 0;
+}
+
+// send replies in one write, keep what the socket does not take for later
+void jtag_rbb_flush() {
+  if (jtag_rbb_tx.empty()) {
+    return;
+  }
+  ssize_t sent = write(client_fd, jtag_rbb_tx.data(), jtag_rbb_tx.size());
+  if (sent > 0) {
+    jtag_rbb_tx.erase(jtag_rbb_tx.begin(), jtag_rbb_tx.begin() + sent);
+  } else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    jtag_rbb_detach();
+  }
+}
+
 void jtag_rbb_tick() {
-  if (client_fd >= 0) {
-    static char read_buffer[128];
-    static size_t read_buffer_count = 0;
-    static size_t read_buffer_offset = 0;
+  if (client_fd < 0) {
+    // accept connection
+    if (jtag_rbb_poll_wait > 0) {
+      jtag_rbb_poll_wait--;
+      return;
+    }
+    jtag_rbb_poll_wait = JTAG_RBB_ACCEPT_INTERVAL;
+    client_fd = accept(listen_fd, NULL, NULL);
+    if (client_fd > 0) {
+      fcntl(client_fd, F_SETFL, O_NONBLOCK);
 
-    if (read_buffer_offset == read_buffer_count) {
-      ssize_t num_read = read(client_fd, read_buffer, sizeof(read_buffer));
-      if (num_read > 0) {
-        read_buffer_count = num_read;
-        read_buffer_offset = 0;
-      } else if (num_read == 0) {
-        // remote socket closed
-        fprintf(stderr, "> JTAG debugger detached\n");
-        close(client_fd);
-        client_fd = -1;
+      // set nodelay
+      int flags = 1;
+      if (setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (void *)&flags,
+                     sizeof(flags)) < 0) {
+        perror("setsockopt");
       }
+      jtag_rbb_poll_interval = jtag_rbb_poll_wait = 0;
+      fprintf(stderr, "> JTAG debugger attached\n");
     }
+    return;
+  }
 
-    if (read_buffer_offset < read_buffer_count) {
-      char command = read_buffer[read_buffer_offset++];
-      if ('0' <= command && command <= '7') {
-        // set
-        char offset = command - '0';
-        top->jtag_TCK = (offset >> 2) & 1;
-        top->jtag_TMS = (offset >> 1) & 1;
-        top->jtag_TDI = (offset >> 0) & 1;
-      } else if (command == 'R') {
-        // read
-        char send = top->jtag_TDO_data ? '1' : '0';
-
-        while (1) {
-          ssize_t sent = write(client_fd, &send, sizeof(send));
-          if (sent > 0) {
-            break;
-          } else if (send < 0) {
-            close(client_fd);
-            client_fd = -1;
-            break;
-          }
+  jtag_rbb_flush();
+  if (client_fd < 0) {
+    return;
+  }
+
+  if (jtag_rbb_rx_offset == jtag_rbb_rx_count) {
+    if (jtag_rbb_poll_wait > 0) {
+      jtag_rbb_poll_wait--;
+      return;
+    }
+    ssize_t num_read = read(client_fd, jtag_rbb_rx, sizeof(jtag_rbb_rx));
+    if (num_read > 0) {
+      jtag_rbb_rx_count = num_read;
+      jtag_rbb_rx_offset = 0;
+      jtag_rbb_poll_interval = 0;
+    } else if (num_read == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      // remote socket closed
+      jtag_rbb_detach();
+      return;
+    } else {
+      // nothing to do, back off exponentially
+      jtag_rbb_poll_interval =
+          std::min(std::max(jtag_rbb_poll_interval * 2, (uint64_t)1),
+                   JTAG_RBB_MAX_POLL_INTERVAL);
+      jtag_rbb_poll_wait = jtag_rbb_poll_interval;
+      return;
+    }
+  }
+
+  uint64_t edges = 0;
+  // pins changed since last eval
+  bool dirty = false;
+  while (jtag_rbb_rx_offset < jtag_rbb_rx_count) {
+    char command = jtag_rbb_rx[jtag_rbb_rx_offset];
+    if ('0' <= command && command <= '7') {
+      // set
+      char offset = command - '0';
+      if (!jtag_rbb_batch && dirty) {
+        break;
+      }
+      if ((offset >> 2) & 1 && !top->jtag_TCK) {
+        if (edges == jtag_rbb_batch && jtag_rbb_batch) {
+          break;
         }
-      } else if (command == 'r' || command == 's') {
-        // trst = 0;
-        // top->io_jtag_trstn = 1;
-      } else if (command == 't' || command == 'u') {
-        // trst = 1;
-        // top->io_jtag_trstn = 0;
+        edges++;
       }
-    }
-  } else {
-    // accept connection
-    client_fd = accept(listen_fd, NULL, NULL);
-    if (client_fd > 0) {
-      fcntl(client_fd, F_SETFL, O_NONBLOCK);
-
-      // set nodelay
-      int flags = 1;
-      if (setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (void *)&flags,
-                     sizeof(flags)) < 0) {
-        perror("setsockopt");
+      if (dirty) {
+        // apply previous edge before the next one
+        top->eval();
       }
-      fprintf(stderr, "> JTAG debugger attached\n");
+      top->jtag_TCK = (offset >> 2) & 1;
+      top->jtag_TMS = (offset >> 1) & 1;
+      top->jtag_TDI = (offset >> 0) & 1;
+      dirty = true;
+    } else if (command == 'R') {
+      // read
+      if (dirty) {
+        top->eval();
+        dirty = false;
+      }
+      jtag_rbb_tx.push_back(top->jtag_TDO_data ? '1' : '0');
+    } else if (command == 'r' || command == 's') {
+      // trst = 0;
+      // top->io_jtag_trstn = 1;
+    } else if (command == 't' || command == 'u') {
+      // trst = 1;
+      // top->io_jtag_trstn = 0;
     }
+    jtag_rbb_rx_offset++;
   }
+  jtag_rbb_flush();
 }
 
 int jtag_vpi_init() {
@@ -1058,19 +1848,678 @@ void jtag_vpi_tick() {
   }
 }
 
+// main memory, same range as MeowV64Configs.scala
+const uint64_t DRAM_BASE = 0x80000000;
+const uint64_t DRAM_SIZE = 0x180000000;
+
+// mem_axi4 of RiscVSystem carries 32 address bits, the backing store sees
+// guest addresses truncated to them
+uint64_t dram_backing_addr(uint64_t addr) { return addr & 0xFFFFFFFF; }
+
+// gdbserver driving the dmi port of the debug module directly, see --gdb
+struct dmi_port {
+  CData *req_valid;
+  CData *req_ready;
+  CData *req_addr;
+  IData *req_data;
+  CData *req_op;
+  CData *resp_valid;
+  CData *resp_ready;
+  IData *resp_data;
+  CData *resp_resp;
+};
+dmi_port dmi;
+
+// probe dmi_* ports, only generated with WithHarnessDMI
+template <typename T, typename = void> struct dmi_probe {
+  static bool probe(T *top, dmi_port &port) { return false; }
+};
+template <typename T>
+struct dmi_probe<T, decltype((void)T::dmi_req_valid)> {
+  static bool probe(T *top, dmi_port &port) {
+    port.req_valid = &top->dmi_req_valid;
+    port.req_ready = &top->dmi_req_ready;
+    port.req_addr = &top->dmi_req_bits_addr;
+    port.req_data = &top->dmi_req_bits_data;
+    port.req_op = &top->dmi_req_bits_op;
+    port.resp_valid = &top->dmi_resp_valid;
+    port.resp_ready = &top->dmi_resp_ready;
+    port.resp_data = &top->dmi_resp_bits_data;
+    port.resp_resp = &top->dmi_resp_bits_resp;
+    return true;
+  }
+};
+
+// serve memory accesses of gdb from the backing store while halted
+bool gdb_direct_memory = false;
+GdbServer *gdb_server = NULL;
+
+// request posted by the gdbserver thread, served at clock fall
+struct gdb_request {
+  // direct memory access instead of dmi
+  bool memory;
+  bool write;
+  uint8_t op;
+  uint32_t addr;
+  uint32_t data;
+  uint64_t mem_addr;
+  uint8_t *buffer;
+  size_t size;
+  bool ok;
+  uint32_t result;
+};
+gdb_request gdb_req;
+// 0 idle, 1 posted, 2 done
+std::atomic<int> gdb_req_state(0);
+bool dmi_inflight = false;
+bool dmi_req_fire = false;
+bool dmi_resp_fire = false;
+
+// called from the gdbserver thread
+bool gdb_post_request() {
+  gdb_req_state.store(1, std::memory_order_release);
+  while (gdb_req_state.load(std::memory_order_acquire) != 2) {
+    if (gdb_server->stopping()) {
+      return false;
+    }
+    std::this_thread::yield();
+  }
+  gdb_req_state.store(0, std::memory_order_relaxed);
+  return gdb_req.ok;
+}
+
+bool gdb_dmi_access(uint8_t op, uint32_t addr, uint32_t data,
+                    uint32_t &result) {
+  gdb_req.memory = false;
+  gdb_req.op = op;
+  gdb_req.addr = addr;
+  gdb_req.data = data;
+  bool ok = gdb_post_request();
+  result = gdb_req.result;
+  return ok;
+}
+
+bool gdb_memory_access(bool write, uint64_t addr, uint8_t *data,
+                       size_t size) {
+  // main memory only, an access must not wrap around the 32-bit mem port
+  if (!gdb_direct_memory || addr < DRAM_BASE ||
+      addr + size > DRAM_BASE + DRAM_SIZE ||
+      (addr >> 32) != ((addr + size - 1) >> 32)) {
+    return false;
+  }
+  gdb_req.memory = true;
+  gdb_req.write = write;
+  gdb_req.mem_addr = dram_backing_addr(addr);
+  gdb_req.buffer = data;
+  gdb_req.size = size;
+  return gdb_post_request();
+}
+
+// handshakes happen at clock rise, sample them before eval
+void gdb_sample() {
+  if (!dmi_inflight) {
+    return;
+  }
+  if (*dmi.req_valid && *dmi.req_ready) {
+    dmi_req_fire = true;
+  }
+  if (*dmi.resp_valid && *dmi.resp_ready) {
+    gdb_req.result = *dmi.resp_data;
+    gdb_req.ok = *dmi.resp_resp == 0;
+    dmi_resp_fire = true;
+  }
+}
+
+void gdb_step() {
+  if (dmi_inflight) {
+    if (dmi_req_fire) {
+      *dmi.req_valid = 0;
+      dmi_req_fire = false;
+    }
+    if (dmi_resp_fire) {
+      *dmi.resp_ready = 0;
+      dmi_resp_fire = false;
+      dmi_inflight = false;
+      gdb_req_state.store(2, std::memory_order_release);
+    }
+    return;
+  }
+  if (gdb_req_state.load(std::memory_order_acquire) != 1) {
+    return;
+  }
+
+  if (gdb_req.memory) {
+    if (gdb_req.write) {
+      memory.write_bytes(gdb_req.mem_addr, gdb_req.buffer, gdb_req.size);
+    } else {
+      memory.read_bytes(gdb_req.mem_addr, gdb_req.buffer, gdb_req.size);
+    }
+    gdb_req.ok = true;
+    gdb_req_state.store(2, std::memory_order_release);
+    return;
+  }
+  *dmi.req_addr = gdb_req.addr;
+  *dmi.req_data = gdb_req.data;
+  *dmi.req_op = gdb_req.op;
+  *dmi.req_valid = 1;
+  *dmi.resp_ready = 1;
+  dmi_inflight = true;
+}
+
+const char *TRACE_PATH = "dump.fst";
+const char *TRACE_PREV_PATH = "dump.prev.fst";
+// trace file is open
+bool tracing = false;
+bool trace_done = false;
+uint64_t trace_segment_begin = 0;
+
+// a closed VerilatedFstC cannot be reopened, each file gets a new writer
+void trace_open() {
+  tfp = new VerilatedFstC;
+  top->trace(tfp, trace_depth);
+  tfp->open(TRACE_PATH);
+  tracing = true;
+}
+
+void trace_close() {
+  if (tracing) {
+    tfp->flush();
+    tfp->close();
+    delete tfp;
+    tfp = nullptr;
+    tracing = false;
+  }
+}
+
+// dump after each eval
+void trace_step() {
+  if (!trace_enabled || trace_done) {
+    return;
+  }
+
+  uint64_t mcycle = top->debug_0_mcycle;
+  if (trace_on_pc && !trace_triggered) {
+    for (auto &core : cores) {
+      if (*core.pc == trace_pc) {
+        trace_fire("pc");
+      }
+    }
+  }
+
+  bool has_trigger = trace_on_pc || trace_on_tohost || trace_on_write;
+  bool active = trace_begin <= mcycle && mcycle < trace_end;
+  if (trace_ring_cycles) {
+    // keep last segments when triggered
+    if (trace_triggered) {
+      trace_close();
+      trace_done = true;
+      return;
+    }
+  } else {
+    active = active && (!has_trigger || trace_triggered);
+  }
+
+  if (!active) {
+    if (tracing && mcycle >= trace_end) {
+      trace_close();
+      trace_done = true;
+    }
+    return;
+  }
+
+  if (!tracing) {
+    trace_open();
+    trace_segment_begin = mcycle;
+    fprintf(stderr, "> Start tracing at mcycle %ld\n", mcycle);
+  } else if (trace_ring_cycles &&
+             mcycle - trace_segment_begin >= trace_ring_cycles) {
+    // rotate
+    trace_close();
+    rename(TRACE_PATH, TRACE_PREV_PATH);
+    trace_open();
+    trace_segment_begin = mcycle;
+  }
+  tfp->dump(main_time);
+}
+
+#ifdef SAVABLE
+// checkpoint file layout:
+// magic, harness state, elf symbols, shadow registers, guest memory pages,
+// verilated model
+// only taken when bus is idle, so no axi or dramsim3 request is in flight,
+// mmio and arbiter state is still saved so a restored run replays exactly
+// harness statistics are not saved, after a restore they cover the run
+// since the checkpoint, while mcycle and minstret come from the model
+// bump the last byte of magic on layout change
+const uint64_t CHECKPOINT_MAGIC = 0x34504356364f454d;
+
+void save_value(VerilatedSave &os, uint64_t value) {
+  os.write(&value, sizeof(value));
+}
+
+uint64_t restore_value(VerilatedRestore &os) {
+  uint64_t value;
+  os.read(&value, sizeof(value));
+  return value;
+}
+
+void save_checkpoint(const char *path) {
+  VerilatedSave os;
+  os.open(path);
+  save_value(os, CHECKPOINT_MAGIC);
+
+  save_value(os, main_time);
+  save_value(os, tohost_addr);
+  save_value(os, fromhost_addr);
+  save_value(os, begin_signature);
+  save_value(os, begin_signature_override);
+  save_value(os, end_signature);
+  save_value(os, park_ranges.size());
+  for (auto &range : park_ranges) {
+    save_value(os, range.first);
+    save_value(os, range.second);
+  }
+  save_value(os, pending_read);
+  save_value(os, pending_read_id);
+  save_value(os, pending_read_addr);
+  save_value(os, pending_read_len);
+  save_value(os, pending_read_size);
+  save_value(os, pending_write);
+  save_value(os, pending_write_finished);
+  save_value(os, pending_write_addr);
+  save_value(os, pending_write_len);
+  save_value(os, pending_write_size);
+  save_value(os, pending_write_id);
+  save_value(os, last_read_request_queue);
+  save_value(os, last_write_request_queue);
+  // the profiler symbolizes samples with these, -R loads no elf
+  save_value(os, symbols.size());
+  for (auto &it : symbols) {
+    save_value(os, it.first.size());
+    os.write(it.first.data(), it.first.size());
+    save_value(os, it.second.addr);
+    save_value(os, it.second.size);
+    save_value(os, it.second.code);
+  }
+  save_value(os, shadow_regs.size());
+  for (auto &regs : shadow_regs) {
+    os.write(&regs, sizeof(regs));
+  }
+
+  save_value(os, memory.get_page_count());
+  memory.for_each_page([&](uint64_t addr, uint8_t *page) {
+    save_value(os, addr);
+    os.write(page, PagedMemory::PAGE_SIZE);
+  });
+
+  os << *top;
+  os.close();
+  fprintf(stderr, "> Saved checkpoint to %s at mcycle %ld\n", path,
+          top->debug_0_mcycle);
+}
+
+void restore_checkpoint(const char *path) {
+  VerilatedRestore os;
+  os.open(path);
+  if (restore_value(os) != CHECKPOINT_MAGIC) {
+    fprintf(stderr, "> Bad checkpoint %s\n", path);
+    exit(1);
+  }
+
+  main_time = restore_value(os);
+  tohost_addr = restore_value(os);
+  fromhost_addr = restore_value(os);
+  begin_signature = restore_value(os);
+  begin_signature_override = restore_value(os);
+  end_signature = restore_value(os);
+  park_ranges.resize(restore_value(os));
+  for (auto &range : park_ranges) {
+    range.first = restore_value(os);
+    range.second = restore_value(os);
+  }
+  pending_read = restore_value(os);
+  pending_read_id = restore_value(os);
+  pending_read_addr = restore_value(os);
+  pending_read_len = restore_value(os);
+  pending_read_size = restore_value(os);
+  pending_write = restore_value(os);
+  pending_write_finished = restore_value(os);
+  pending_write_addr = restore_value(os);
+  pending_write_len = restore_value(os);
+  pending_write_size = restore_value(os);
+  pending_write_id = restore_value(os);
+  mmio_pending = pending_read || pending_write;
+  last_read_request_queue = restore_value(os);
+  last_write_request_queue = restore_value(os);
+  symbols.clear();
+  uint64_t symbol_count = restore_value(os);
+  symbols.reserve(symbol_count);
+  for (uint64_t i = 0; i < symbol_count; i++) {
+    std::string name(restore_value(os), '\0');
+    os.read(&name[0], name.size());
+    elf_symbol symbol;
+    symbol.addr = restore_value(os);
+    symbol.size = restore_value(os);
+    symbol.code = restore_value(os);
+    symbols.insert(std::make_pair(name, symbol));
+  }
+  shadow_regs.resize(restore_value(os));
+  for (auto &regs : shadow_regs) {
+    os.read(&regs, sizeof(regs));
+  }
+
+  memory.clear();
+  uint64_t page_count = restore_value(os);
+  for (uint64_t i = 0; i < page_count; i++) {
+    uint64_t addr = restore_value(os);
+    os.read(memory.get_page(addr), PagedMemory::PAGE_SIZE);
+  }
+
+  os >> *top;
+  os.close();
+  fprintf(stderr, "> Restored checkpoint from %s at mcycle %ld\n", path,
+          top->debug_0_mcycle);
+  fprintf(stderr, "> Harness statistics cover the run since the checkpoint\n");
+}
+#endif
+
+// machine readable report
+// bump STATS_VERSION on incompatible schema change
+const uint64_t STATS_VERSION = 1;
+// snapshot every stats_interval mcycle, 0 to disable
+uint64_t stats_interval = 0;
+
+struct stats_snapshot {
+  uint64_t elapsed_us;
+  uint64_t memory_read_bytes;
+  uint64_t memory_write_bytes;
+  std::vector<uint64_t> mcycle;
+  std::vector<uint64_t> minstret;
+};
+std::vector<stats_snapshot> snapshots;
+
+void take_snapshot(uint64_t elapsed_us) {
+  stats_snapshot snapshot;
+  snapshot.elapsed_us = elapsed_us;
+  snapshot.memory_read_bytes = memory_read_bytes;
+  snapshot.memory_write_bytes = memory_write_bytes;
+  for (auto &debug : cores) {
+    snapshot.mcycle.push_back(*debug.mcycle);
+    snapshot.minstret.push_back(*debug.minstret);
+  }
+  snapshots.push_back(snapshot);
+}
+
+// read whole file, empty if missing
+std::vector<char> read_file(const char *path) {
+  std::vector<char> content;
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    return content;
+  }
+  char buffer[4096];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    content.insert(content.end(), buffer, buffer + size);
+  }
+  fclose(fp);
+  return content;
+}
+
+// dramsim3 json stats, empty if unavailable
+std::vector<char> dram_stats;
+
+// dramsim3 writes out/<output_prefix>.json on PrintStats
+void collect_dram_stats() {
+  dram_system->PrintStats();
+  dram_stats = read_file("out/dramsim3.json");
+}
+
+// sum numbers of all "key": value pairs, e.g. over dramsim3 channels
+double sum_json_key(const std::vector<char> &json, const char *key) {
+  std::string content(json.begin(), json.end());
+  std::string pattern = std::string("\"") + key + "\":";
+  double sum = 0;
+  for (size_t pos = content.find(pattern); pos != std::string::npos;
+       pos = content.find(pattern, pos + 1)) {
+    sum += atof(content.c_str() + pos + pattern.size());
+  }
+  return sum;
+}
+
+// fraction of dram read/write commands that hit an open row, -1 if unknown
+double row_buffer_hit_rate() {
+  double cmds = sum_json_key(dram_stats, "num_read_cmds") +
+                sum_json_key(dram_stats, "num_write_cmds");
+  double hits = sum_json_key(dram_stats, "num_read_row_hits") +
+                sum_json_key(dram_stats, "num_write_row_hits");
+  return cmds > 0 ? hits / cmds : -1;
+}
+
+void print_latency(const char *name, const Histogram &latency) {
+  fprintf(stderr,
+          "> %s latency: count=%ld mean=%.2lf p50=%ld p90=%ld p99=%ld "
+          "max=%ld cycles\n",
+          name, latency.get_count(), latency.get_mean(),
+          latency.percentile(0.5), latency.percentile(0.9),
+          latency.percentile(0.99), latency.get_max());
+}
+
+void print_bandwidth(const char *name, const std::vector<uint64_t> &buckets) {
+  uint64_t peak = 0;
+  for (uint64_t bytes : buckets) {
+    peak = std::max(peak, bytes);
+  }
+  fprintf(stderr, "> %s bandwidth: peak %.2lf bytes/cycle over %ld cycles\n",
+          name, (double)peak / mem_bucket_cycles, mem_bucket_cycles);
+}
+
+void print_mem_stats() {
+  print_latency("Read", read_latency);
+  print_latency("Write", write_latency);
+  print_bandwidth("Read", read_bucket_bytes);
+  print_bandwidth("Write", write_bucket_bytes);
+  fprintf(stderr, "> Outstanding reads: mean=%.2lf max=%ld\n",
+          read_occupancy.get_mean(), read_occupancy.get_max());
+  fprintf(stderr, "> Outstanding writes: mean=%.2lf max=%ld\n",
+          write_occupancy.get_mean(), write_occupancy.get_max());
+  if (row_buffer_hit_rate() >= 0) {
+    fprintf(stderr, "> Row buffer hit rate: %.2lf%%\n",
+            row_buffer_hit_rate() * 100);
+  }
+}
+
+void write_latency_json(JsonWriter &json, const char *key,
+                        const Histogram &latency) {
+  json.begin_object(key);
+  json.value("count", latency.get_count());
+  json.value("mean", latency.get_mean());
+  json.value("p50", latency.percentile(0.5));
+  json.value("p90", latency.percentile(0.9));
+  json.value("p99", latency.percentile(0.99));
+  json.value("max", latency.get_max());
+  json.end_object();
+}
+
+void write_occupancy_json(JsonWriter &json, const char *key,
+                          const Histogram &occupancy) {
+  json.begin_object(key);
+  json.value("mean", occupancy.get_mean());
+  json.value("max", occupancy.get_max());
+  // cycles with N requests outstanding
+  json.array("cycles", occupancy.get_counts().data(),
+             occupancy.get_counts().size());
+  json.end_object();
+}
+
+void write_stats_json(const char *path, const char *binary,
+                      const std::string &dramsim_config, uint64_t elapsed_us) {
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    fprintf(stderr, "> Failed to open %s\n", path);
+    return;
+  }
+
+  JsonWriter json(fp);
+  json.begin_object();
+  json.value("version", STATS_VERSION);
+  json.value("binary", binary);
+  json.value("result", (uint64_t)res);
+
+  json.begin_object("config");
+  json.value("dram", dram);
+  json.value("dramsim_config", dram ? dramsim_config.c_str() : NULL);
+  json.value("ideal_latency", ideal_latency);
+  json.value("ideal_max_outstanding", ideal_max_outstanding);
+  json.value("stats_interval", stats_interval);
+  json.end_object();
+
+  json.begin_object("host");
+  json.value("wall_time_us", elapsed_us);
+  json.value("mcycle_per_second",
+             elapsed_us ? (double)*cores[0].mcycle * 1000000 / elapsed_us
+                        : 0.0);
+  json.end_object();
+
+  json.value("cycles", cycles);
+  json.begin_object("aggregate");
+  json.value("minstret", total_minstret());
+  json.value("ipc", (double)total_minstret() / *cores[0].mcycle);
+  write_top_down_json(json, total_stats().top_down,
+                      cycles * ISSUE_NUM * cores.size());
+  json.end_object();
+  json.begin_array("cores");
+  for (size_t i = 0; i < cores.size(); i++) {
+    const core_stats &s = stats[i];
+    json.begin_object();
+    json.value("hart", (uint64_t)i);
+    json.value("mcycle", *cores[i].mcycle);
+    json.value("minstret", *cores[i].minstret);
+    json.value("ipc", *cores[i].mcycle
+                          ? (double)*cores[i].minstret / *cores[i].mcycle
+                          : 0.0);
+    json.array("iq_empty_cycles", s.iq_empty_cycle_count, MAX_IQ_COUNT);
+    json.array("iq_full_cycles", s.iq_full_cycle_count, MAX_IQ_COUNT);
+    json.value("issue_bounded_by_rob_cycles", s.issue_num_bounded_by_rob_size);
+    json.value("issue_bounded_by_lsq_cycles", s.issue_num_bounded_by_lsq_size);
+    json.array("issue_num_cycles", s.issue_num, ISSUE_NUM + 1);
+    json.array("retire_num_cycles", s.retire_num, ISSUE_NUM + 1);
+    write_top_down_json(json, s.top_down, cycles * ISSUE_NUM);
+    json.end_object();
+  }
+  json.end_array();
+
+  json.begin_object("memory");
+  json.value("read_bytes", memory_read_bytes);
+  json.value("write_bytes", memory_write_bytes);
+  write_latency_json(json, "read_latency", read_latency);
+  write_latency_json(json, "write_latency", write_latency);
+  write_occupancy_json(json, "read_outstanding", read_occupancy);
+  write_occupancy_json(json, "write_outstanding", write_occupancy);
+  json.value("bucket_cycles", mem_bucket_cycles);
+  json.array("read_bucket_bytes", read_bucket_bytes.data(),
+             read_bucket_bytes.size());
+  json.array("write_bucket_bytes", write_bucket_bytes.data(),
+             write_bucket_bytes.size());
+  if (row_buffer_hit_rate() >= 0) {
+    json.value("row_buffer_hit_rate", row_buffer_hit_rate());
+  } else {
+    json.value("row_buffer_hit_rate", (const char *)NULL);
+  }
+  json.end_object();
+
+  json.raw("dramsim3", dram_stats);
+
+  json.begin_array("intervals");
+  for (auto &snapshot : snapshots) {
+    json.begin_object();
+    json.value("wall_time_us", snapshot.elapsed_us);
+    json.value("memory_read_bytes", snapshot.memory_read_bytes);
+    json.value("memory_write_bytes", snapshot.memory_write_bytes);
+    json.array("mcycle", snapshot.mcycle.data(), snapshot.mcycle.size());
+    json.array("minstret", snapshot.minstret.data(), snapshot.minstret.size());
+    json.end_object();
+  }
+  json.end_array();
+
+  json.end_object();
+  fprintf(fp, "\n");
+  fclose(fp);
+  fprintf(stderr, "> Wrote stats to %s\n", path);
+}
+
 int main(int argc, char **argv) {
   Verilated::commandArgs(argc, argv);
 
   signal(SIGINT, ctrlc_handler);
 
   // https://man7.org/linux/man-pages/man3/getopt.3.html
+  enum {
+    OPT_TRACE_WINDOW = 256,
+    OPT_TRACE_PC,
+    OPT_TRACE_TOHOST,
+    OPT_TRACE_WRITE,
+    OPT_TRACE_RING,
+    OPT_TRACE_DEPTH,
+    OPT_STATS_JSON,
+    OPT_STATS_INTERVAL,
+    OPT_MEM_BUCKET,
+    OPT_COSIM,
+    OPT_COSIM_ISA,
+    OPT_COSIM_START,
+    OPT_RETIRE_TRACE,
+    OPT_RETIRE_TRACE_FIELDS,
+    OPT_PROFILE,
+    OPT_PROFILE_INTERVAL,
+    OPT_DRAM_THREAD,
+    OPT_JTAG_BATCH,
+    OPT_GDB,
+    OPT_GDB_DIRECT_MEM,
+    OPT_CONSOLE_FLUSH_EXIT,
+    OPT_DEADLOCK_EXIT,
+  };
+  static struct option long_options[] = {
+      {"trace-window", required_argument, 0, OPT_TRACE_WINDOW},
+      {"trace-pc", required_argument, 0, OPT_TRACE_PC},
+      {"trace-tohost", required_argument, 0, OPT_TRACE_TOHOST},
+      {"trace-write", required_argument, 0, OPT_TRACE_WRITE},
+      {"trace-ring", required_argument, 0, OPT_TRACE_RING},
+      {"trace-depth", required_argument, 0, OPT_TRACE_DEPTH},
+      {"stats-json", required_argument, 0, OPT_STATS_JSON},
+      {"stats-interval", required_argument, 0, OPT_STATS_INTERVAL},
+      {"mem-bucket", required_argument, 0, OPT_MEM_BUCKET},
+      {"cosim", no_argument, 0, OPT_COSIM},
+      {"cosim-isa", required_argument, 0, OPT_COSIM_ISA},
+      {"cosim-start", required_argument, 0, OPT_COSIM_START},
+      {"retire-trace", required_argument, 0, OPT_RETIRE_TRACE},
+      {"retire-trace-fields", required_argument, 0, OPT_RETIRE_TRACE_FIELDS},
+      {"profile", required_argument, 0, OPT_PROFILE},
+      {"profile-interval", required_argument, 0, OPT_PROFILE_INTERVAL},
+      {"dram-thread", no_argument, 0, OPT_DRAM_THREAD},
+      {"jtag-batch", required_argument, 0, OPT_JTAG_BATCH},
+      {"gdb", required_argument, 0, OPT_GDB},
+      {"gdb-direct-mem", no_argument, 0, OPT_GDB_DIRECT_MEM},
+      {"console-flush-exit", no_argument, 0, OPT_CONSOLE_FLUSH_EXIT},
+      {"deadlock-exit", no_argument, 0, OPT_DEADLOCK_EXIT},
+      {0, 0, 0, 0}};
   int opt;
   bool trace = false;
   bool progress = false;
   const char *signature_path = "dump.sig";
   int signature_granularity = 16;
   std::string dramsim_config = "../common/DDR4_8Gb_x8_8b_3200.ini";
-  while ((opt = getopt(argc, argv, "tpjvdD:s:S:")) != -1) {
+  std::string checkpoint_save_path;
+  uint64_t checkpoint_save_mcycle = 0;
+  std::string checkpoint_restore_path;
+  const char *stats_json_path = NULL;
+  bool cosim_enabled = false;
+  const char *cosim_isa = "rv64imafdc";
+  uint64_t cosim_start = 0x80000000;
+  const char *retire_trace_path = NULL;
+  uint32_t retire_trace_fields = 0;
+  const char *profile_path = NULL;
+  while ((opt = getopt_long(argc, argv, "tpjvdD:s:S:l:o:P:C:R:",
+                            long_options, NULL)) != -1) {
     switch (opt) {
     case 't':
       trace = true;
@@ -1099,29 +2548,191 @@ int main(int argc, char **argv) {
     case 'S':
       sscanf(optarg, "%d", &signature_granularity);
       break;
+    case 'l':
+      sscanf(optarg, "%ld", &ideal_latency);
+      break;
+    case 'o':
+      sscanf(optarg, "%ld", &ideal_max_outstanding);
+      assert(ideal_max_outstanding > 0);
+      break;
+    case 'P':
+      park_symbols.push_back(optarg);
+      break;
+    case 'C': {
+      // path@mcycle
+      std::string arg = optarg;
+      size_t at = arg.rfind('@');
+      if (at == std::string::npos) {
+        fprintf(stderr, "> Expect -C path@mcycle\n");
+        return 1;
+      }
+      checkpoint_save_path = arg.substr(0, at);
+      sscanf(arg.substr(at + 1).c_str(), "%ld", &checkpoint_save_mcycle);
+      break;
+    }
+    case 'R':
+      checkpoint_restore_path = optarg;
+      break;
+    case OPT_TRACE_WINDOW:
+      // begin:end in mcycle, end is optional
+      trace = true;
+      if (sscanf(optarg, "%ld:%ld", &trace_begin, &trace_end) < 1) {
+        fprintf(stderr, "> Expect --trace-window begin:end\n");
+        return 1;
+      }
+      break;
+    case OPT_TRACE_PC:
+      trace = true;
+      trace_on_pc = true;
+      sscanf(optarg, "%lx", &trace_pc);
+      break;
+    case OPT_TRACE_TOHOST:
+      trace = true;
+      trace_on_tohost = true;
+      sscanf(optarg, "%lx", &trace_tohost);
+      break;
+    case OPT_TRACE_WRITE:
+      trace = true;
+      trace_on_write = true;
+      sscanf(optarg, "%lx", &trace_write_addr);
+      break;
+    case OPT_TRACE_RING:
+      trace = true;
+      sscanf(optarg, "%ld", &trace_ring_cycles);
+      break;
+    case OPT_TRACE_DEPTH:
+      sscanf(optarg, "%d", &trace_depth);
+      break;
+    case OPT_STATS_JSON:
+      stats_json_path = optarg;
+      break;
+    case OPT_STATS_INTERVAL:
+      sscanf(optarg, "%ld", &stats_interval);
+      break;
+    case OPT_MEM_BUCKET:
+      sscanf(optarg, "%ld", &mem_bucket_cycles);
+      assert(mem_bucket_cycles > 0);
+      break;
+    case OPT_COSIM:
+      cosim_enabled = true;
+      break;
+    case OPT_COSIM_ISA:
+      cosim_isa = optarg;
+      break;
+    case OPT_COSIM_START:
+      sscanf(optarg, "%lx", &cosim_start);
+      break;
+    case OPT_RETIRE_TRACE:
+      retire_trace_path = optarg;
+      break;
+    case OPT_RETIRE_TRACE_FIELDS: {
+      // comma separated list of cycle, rd and mem
+      std::string fields = optarg;
+      if (fields.find("cycle") != std::string::npos) {
+        retire_trace_fields |= RETIRE_TRACE_CYCLE;
+      }
+      if (fields.find("rd") != std::string::npos) {
+        retire_trace_fields |= RETIRE_TRACE_RD;
+      }
+      if (fields.find("mem") != std::string::npos) {
+        retire_trace_fields |= RETIRE_TRACE_MEM;
+      }
+      break;
+    }
+    case OPT_PROFILE:
+      profile_path = optarg;
+      if (!profile_interval) {
+        profile_interval = 1000;
+      }
+      break;
+    case OPT_PROFILE_INTERVAL:
+      sscanf(optarg, "%ld", &profile_interval);
+      assert(profile_interval > 0);
+      break;
+    case OPT_DRAM_THREAD:
+      dram_thread = true;
+      break;
+    case OPT_JTAG_BATCH:
+      sscanf(optarg, "%ld", &jtag_rbb_batch);
+      break;
+    case OPT_GDB:
+      sscanf(optarg, "%d", &gdb_port);
+      break;
+    case OPT_GDB_DIRECT_MEM:
+      gdb_direct_memory = true;
+      break;
+    case OPT_CONSOLE_FLUSH_EXIT:
+      console_flush_exit = true;
+      break;
+    case OPT_DEADLOCK_EXIT:
+      deadlock_exit = true;
+      break;
     default: /* '?' */
       fprintf(stderr,
               "Usage: %s [-t] [-p] [-j] [-v] [-d] [-D config] [-s signature] "
-              "[-S granularity] "
-              "name\n",
+              "[-S granularity] [-l latency] [-o outstanding] "
+              "[-P symbol] [-C path@mcycle] [-R path] "
+              "[--trace-window begin:end] [--trace-pc pc] "
+              "[--trace-tohost value] [--trace-write addr] "
+              "[--trace-ring cycles] [--trace-depth depth] "
+              "[--stats-json path] [--stats-interval mcycle] "
+              "[--mem-bucket cycles] [--cosim] [--cosim-isa isa] "
+              "[--cosim-start pc] [--retire-trace path] "
+              "[--retire-trace-fields cycle,rd,mem] [--profile path] "
+              "[--profile-interval cycles] [--dram-thread] "
+              "[--jtag-batch edges] [--gdb port] [--gdb-direct-mem] "
+              "[--console-flush-exit] [--deadlock-exit] name\n",
               argv[0]);
       return 1;
     }
   }
 
-  if (optind < argc) {
+#ifndef SAVABLE
+  if (!checkpoint_save_path.empty() || !checkpoint_restore_path.empty()) {
+    fprintf(stderr,
+            "> Checkpoint requires building with VERILATOR_SAVABLE=1\n");
+    return 1;
+  }
+#endif
+#ifndef COSIM
+  if (cosim_enabled) {
+    fprintf(stderr, "> Cosim requires building with VERILATOR_COSIM=1\n");
+    return 1;
+  }
+#endif
+  if (!checkpoint_save_path.empty() && (jtag || gdb_port)) {
+    fprintf(stderr, "> Checkpoint is not supported in jtag or gdb mode\n");
+    return 1;
+  }
+
+  if (!checkpoint_restore_path.empty() && optind < argc) {
+    fprintf(stderr, "> Binary %s conflicts with -R, guest memory comes from "
+                    "the checkpoint\n",
+            argv[optind]);
+    return 1;
+  } else if (optind < argc) {
     load_file(argv[optind]);
   }
 
+  if (!dram) {
+    fprintf(stderr, "> Using ideal memory latency=%ld outstanding=%ld\n",
+            ideal_latency, ideal_max_outstanding);
+  }
+
   if (dram) {
     fprintf(stderr, "> Using dramsim3 config %s\n", dramsim_config.c_str());
     dram_system = new dramsim3::MemorySystem(dramsim_config, "out",
                                              read_callback, write_callback);
     fprintf(stderr, "> DRAM tCK=%.2lf BL=%d Width=%d\n", dram_system->GetTCK(),
             dram_system->GetBurstLength(), dram_system->GetBusBits());
+  } else {
+    dram_thread = false;
   }
 
   top = new VRiscVSystem;
+  discover_cores<0>();
+  fprintf(stderr, "> Found %ld cores\n", cores.size());
+  stats.resize(cores.size());
 
   if (jtag) {
     if (jtag_rbb && jtag_rbb_init() < 0) {
@@ -1138,12 +2749,26 @@ int main(int argc, char **argv) {
     // top->io_jtag_trstn = 1;
   }
 
-  VerilatedFstC *tfp = nullptr;
+  // models with the dmi port have no jtag dtm, idle dmi until --gdb
+  bool has_dmi = dmi_probe<VRiscVSystem>::probe(top, dmi);
+  if (has_dmi) {
+    *dmi.req_valid = 0;
+    *dmi.resp_ready = 0;
+    if (jtag) {
+      fprintf(stderr, "> Model exports dmi instead of jtag, use --gdb\n");
+      return 1;
+    }
+  }
+
+  if (gdb_port && !has_dmi) {
+    fprintf(stderr, "> GDB server requires a model with the dmi port, "
+                    "e.g. SingleCoreGdbConfig\n");
+    return 1;
+  }
+
   if (trace) {
     Verilated::traceEverOn(true);
-    tfp = new VerilatedFstC;
-    top->trace(tfp, 99);
-    tfp->open("dump.fst");
+    trace_enabled = true;
     fprintf(stderr, "> Enable tracing\n");
   }
 
@@ -1151,15 +2776,69 @@ int main(int argc, char **argv) {
   top->clock = 0;
   init();
 
-  const size_t MAX_IQ_COUNT = 4;
-  const size_t ISSUE_NUM = 2;
-  size_t iq_empty_cycle_count[MAX_IQ_COUNT] = {};
-  size_t iq_full_cycle_count[MAX_IQ_COUNT] = {};
-  size_t cycles = 0;
-  size_t issue_num_bounded_by_rob_size = 0;
-  size_t issue_num_bounded_by_lsq_size = 0;
-  size_t issue_num[ISSUE_NUM + 1] = {};
-  size_t retire_num[ISSUE_NUM + 1] = {};
+  if ((retire_trace_path || cosim_enabled) &&
+      (cores.empty() || !cores[0].has_retire)) {
+    fprintf(stderr, "> Retire trace and cosim require retireTrace in "
+                    "WithMeowV64Cores\n");
+    return 1;
+  }
+  if (retire_trace_path) {
+    if (cores.size() > RETIRE_TRACE_MAX_HARTS ||
+        !retire_trace_writer.open(retire_trace_path, retire_trace_fields)) {
+      fprintf(stderr, "> Failed to open retire trace %s\n",
+              retire_trace_path);
+      return 1;
+    }
+    retire_trace_enabled = true;
+    fprintf(stderr, "> Writing retire trace to %s\n", retire_trace_path);
+  }
+
+#ifdef SAVABLE
+  if (!checkpoint_restore_path.empty()) {
+    restore_checkpoint(checkpoint_restore_path.c_str());
+  }
+#endif
+
+  if (!checkpoint_save_path.empty() && !cores.empty() &&
+      cores[0].has_retire) {
+    // registers restored from a checkpoint are the starting point
+    shadow_regs.resize(cores.size());
+    shadow_regs_enabled = true;
+  }
+
+#ifdef COSIM
+  if (cosim_enabled) {
+    cosim = true;
+    // reference starts from the restored memory and registers
+    cosim_init(cosim_isa, cores.size(), DRAM_BASE, DRAM_SIZE, cosim_start);
+    memory.for_each_page([](uint64_t addr, uint8_t *page) {
+      cosim_write_memory(addr, page, PagedMemory::PAGE_SIZE);
+    });
+    if (!checkpoint_restore_path.empty()) {
+      if (shadow_regs.size() == cores.size()) {
+        for (size_t i = 0; i < cores.size(); i++) {
+          cosim_seed(i, shadow_regs[i].xpr, shadow_regs[i].fpr);
+        }
+      } else {
+        fprintf(stderr, "> Checkpoint has no registers, cosim starts at pc "
+                        "%lx\n",
+                cosim_start);
+      }
+    }
+  }
+#endif
+
+  if (gdb_port) {
+    gdb_server = new GdbServer(gdb_dmi_access, gdb_memory_access,
+                               std::max(cores.size(), (size_t)1));
+    if (!gdb_server->start(gdb_port)) {
+      return 1;
+    }
+  }
+  if (dram_thread) {
+    fprintf(stderr, "> Ticking dramsim3 on a separate thread\n");
+    dram_thread_start();
+  }
 
   fprintf(stderr, "> Simulation started\n");
   uint64_t begin = get_time_us();
@@ -1174,6 +2853,15 @@ int main(int argc, char **argv) {
   // maintain tCK ratio
   double time_diff = 0;
   while (!Verilated::gotFinish() && !finished) {
+#ifdef SAVABLE
+    // save before clock rise when no transaction is in flight
+    if (!checkpoint_save_path.empty() && (main_time % 10) == 0 &&
+        top->debug_0_mcycle >= checkpoint_save_mcycle && bus_idle()) {
+      save_checkpoint(checkpoint_save_path.c_str());
+      checkpoint_save_path.clear();
+    }
+#endif
+
     if (main_time > 50) {
       top->reset = 0;
     }
@@ -1195,26 +2883,43 @@ int main(int argc, char **argv) {
         res = 1;
       }
 
-      // accumulate rs free cycles
-      for (int i = 0; i < MAX_IQ_COUNT; i++) {
-        if ((top->debug_0_iqEmptyMask >> i) & 1) {
-          iq_empty_cycle_count[i]++;
-        }
-        if ((top->debug_0_iqFullMask >> i) & 1) {
-          iq_full_cycle_count[i]++;
-        }
+      accumulate_stats();
+#ifdef COSIM
+      if (cosim) {
+        cosim_step();
       }
-
-      if (top->debug_0_issueNumBoundedByROBSize) {
-        issue_num_bounded_by_rob_size++;
+#endif
+      if (retire_trace_enabled) {
+        retire_trace_step();
+      }
+      if (shadow_regs_enabled) {
+        shadow_regs_step();
       }
-      if (top->debug_0_issueNumBoundedByLSQSize) {
-        issue_num_bounded_by_lsq_size++;
+      if (profile_path && (cycles % profile_interval) == 0) {
+        profile_step();
       }
-      issue_num[top->debug_0_issueNum]++;
-      retire_num[top->debug_0_retireNum]++;
 
-      cycles++;
+      if (stats_interval && top->debug_0_mcycle > 0 &&
+          (top->debug_0_mcycle % stats_interval) == 0) {
+        take_snapshot(get_time_us() - begin);
+      }
+
+      // all harts are parked for a while and nothing can wake them up
+      if (deadlock_exit) {
+        const uint64_t PARK_WINDOW = 1000;
+        static uint64_t idle_cycles = 0;
+        if (system_idle()) {
+          idle_cycles++;
+        } else {
+          idle_cycles = 0;
+        }
+        if (idle_cycles >= PARK_WINDOW) {
+          fprintf(stderr, "> Deadlock: all harts parked with interrupts "
+                          "disabled, exiting\n");
+          finished = true;
+          res = 1;
+        }
+      }
     }
     if ((main_time % 10) == 5) {
       top->clock = 0;
@@ -1223,10 +2928,20 @@ int main(int argc, char **argv) {
 
       if (dram) {
         time_diff += clock_period;
+        uint64_t ticks = 0;
         while (time_diff > dram_clock_period) {
           time_diff -= dram_clock_period;
-          dram_system->ClockTick();
+          ticks++;
         }
+        dram_tick(ticks);
+      }
+    }
+
+    if (gdb_port) {
+      if ((main_time % 10) == 0) {
+        gdb_sample();
+      } else {
+        gdb_step();
       }
     }
 
@@ -1241,49 +2956,79 @@ int main(int argc, char **argv) {
     }
 
     top->eval();
-    if (tfp) {
-      tfp->dump(main_time);
-      // tfp->flush();
-    }
+    trace_step();
     main_time += 5;
   }
   uint64_t elapsed_us = get_time_us() - begin;
+  if (gdb_server) {
+    gdb_server->stop();
+  }
+  console_flush();
   fprintf(stderr, "> Simulation finished\n");
   fprintf(stderr, "> mcycle: %ld\n", top->debug_0_mcycle);
   fprintf(stderr, "> minstret: %ld\n", top->debug_0_minstret);
   fprintf(stderr, "> IPC: %.2lf\n",
           (double)top->debug_0_minstret / top->debug_0_mcycle);
+  if (cores.size() > 1) {
+    // summed over all harts, per hart-0 mcycle
+    fprintf(stderr, "> total minstret: %ld\n", total_minstret());
+    fprintf(stderr, "> aggregate IPC: %.2lf\n",
+            (double)total_minstret() / top->debug_0_mcycle);
+  }
   fprintf(stderr, "> Simulation speed: %.2lf mcycle/s\n",
           (double)top->debug_0_mcycle * 1000000 / elapsed_us);
-  fprintf(stderr, "> Issue queue empty cycle:");
-  for (int i = 0; i < MAX_IQ_COUNT; i++) {
-    fprintf(stderr, " %.2lf%%", iq_empty_cycle_count[i] * 100.0 / cycles);
+  if (cores.size() > 1) {
+    print_core_table();
   }
-  fprintf(stderr, "\n");
-  fprintf(stderr, "> Issue queue full cycle:");
-  for (int i = 0; i < MAX_IQ_COUNT; i++) {
-    fprintf(stderr, " %.2lf%%", iq_full_cycle_count[i] * 100.0 / cycles);
+
+  print_pipeline_stats("", stats[0], cycles);
+  if (cores.size() > 1) {
+    // averaged over all harts
+    print_pipeline_stats("All harts: ", total_stats(), cycles * cores.size());
   }
-  fprintf(stderr, "\n");
-  fprintf(stderr, "> Cycles when issue num is bounded by ROB size: %.2lf%%\n",
-          issue_num_bounded_by_rob_size * 100.0 / cycles);
-  fprintf(stderr, "> Cycles when issue num is bounded by LSQ size: %.2lf%%\n",
-          issue_num_bounded_by_lsq_size * 100.0 / cycles);
 
-  fprintf(stderr, "> Issue num:");
-  for (int i = 0; i <= ISSUE_NUM; i++) {
-    fprintf(stderr, " %d=%.2lf%%", i, issue_num[i] * 100.0 / cycles);
+  fprintf(stderr, "> Memory access: %ld bytes read, %ld bytes written\n",
+          memory_read_bytes, memory_write_bytes);
+#ifdef COSIM
+  if (cosim) {
+    for (size_t i = 0; i < cores.size(); i++) {
+      fprintf(stderr, "> Cosim checked %ld instructions on hart %ld\n",
+              cosim_checked(i), i);
+    }
+  }
+#endif
+  if (dram) {
+    dram_thread_stop();
+    collect_dram_stats();
+  }
+  print_mem_stats();
+
+  if (profile_path) {
+    // reuse the symbol table indexed by load_file
+    Symbolizer symbolizer;
+    for (auto &it : symbols) {
+      if (it.second.code) {
+        symbolizer.add(it.first, it.second.addr, it.second.size);
+      }
+    }
+    write_profile(profile_path, symbolizer);
   }
-  fprintf(stderr, "\n");
 
-  fprintf(stderr, "> Retire num:");
-  for (int i = 0; i <= ISSUE_NUM; i++) {
-    fprintf(stderr, " %d=%.2lf%%", i, retire_num[i] * 100.0 / cycles);
+  if (retire_trace_enabled) {
+    retire_trace_writer.close();
+    if (retire_trace_writer.ok()) {
+      fprintf(stderr, "> Wrote %ld records to retire trace\n",
+              retire_trace_writer.get_count());
+    } else {
+      fprintf(stderr, "> Retire trace aborted, file is truncated\n");
+      res = 1;
+    }
   }
-  fprintf(stderr, "\n");
 
-  fprintf(stderr, "> Memory access: %ld bytes read, %ld bytes written\n",
-          memory_read_bytes, memory_write_bytes);
+  if (stats_json_path) {
+    write_stats_json(stats_json_path, optind < argc ? argv[optind] : NULL,
+                     dramsim_config, elapsed_us);
+  }
 
   if (begin_signature && end_signature) {
     if (begin_signature_override) {
@@ -1299,17 +3044,25 @@ int main(int argc, char **argv) {
          addr += signature_granularity) {
       uint64_t words = signature_granularity / sizeof(mem_t);
       for (uint64_t i = 0; i < signature_granularity; i += sizeof(mem_t)) {
-        fprintf(fp, "%08lx",
-                memory[addr + signature_granularity - sizeof(mem_t) - i]);
+        fprintf(fp, "%08x",
+                memory.read(addr + signature_granularity - sizeof(mem_t) - i));
       }
       fprintf(fp, "\n");
     }
     fclose(fp);
   }
 
-  if (tfp) {
-    tfp->flush();
-    tfp->close();
+  if (trace_enabled) {
+    trace_close();
+    if (trace_ring_cycles && !trace_triggered && res == 0) {
+      // nothing interesting happened
+      remove(TRACE_PATH);
+      remove(TRACE_PREV_PATH);
+      fprintf(stderr, "> Discarded ring buffer trace\n");
+    } else if (trace_ring_cycles) {
+      fprintf(stderr, "> Ring buffer trace saved to %s and %s\n",
+              TRACE_PREV_PATH, TRACE_PATH);
+    }
   }
   top->final();
   delete top;
@@ -1,9 +1,7 @@
 #include "VRiscVSystem.h"
 #include <arpa/inet.h>
 #include <fcntl.h>
-#include <gmpxx.h>
 #include <iostream>
-#include <map>
 #include <netinet/tcp.h>
 #include <signal.h>
 #include <string>
@@ -12,6 +10,9 @@
 #include <verilated.h>
 #include <verilated_fst_c.h>
 
+#include "../common/axi.h"
+#include "../common/memory.h"
+
 #ifdef __APPLE__
 #include "elf-local.h"
 #else
@@ -19,8 +20,7 @@
 #endif
 
 // memory mapping
-typedef uint32_t mem_t;
-std::map<uint64_t, mem_t> memory;
+PagedMemory memory;
 
 // align to mem_t boundary
 uint64_t align(uint64_t addr) { return (addr / sizeof(mem_t)) * sizeof(mem_t); }
@@ -138,29 +138,10 @@ void step_mem() {
 
     top->mem_axi4_RVALID = 1;
     top->mem_axi4_RID = pending_read_id;
-    mpz_class r_data;
-
-    uint64_t aligned =
-        (pending_read_addr / MEM_AXI_DATA_BYTES) * MEM_AXI_DATA_BYTES;
-    for (int i = 0; i < MEM_AXI_DATA_BYTES / sizeof(mem_t); i++) {
-      uint64_t addr = aligned + i * sizeof(mem_t);
-      mem_t r = memory[addr];
-      mpz_class res = r;
-      res <<= (i * (sizeof(mem_t) * 8));
-      r_data += res;
-    }
-
-    mpz_class mask = 1;
-    mask <<= (1L << pending_read_size) * 8;
-    mask -= 1;
-
-    mpz_class shifted_mask =
-        mask << ((pending_read_addr & (MEM_AXI_DATA_BYTES - 1)) * 8);
-    r_data &= shifted_mask;
-
-    // top->mem_axi4_RDATA = r_data & shifted_mask;
-    memset(top->mem_axi4_RDATA, 0, sizeof(top->mem_axi4_RDATA));
-    mpz_export(top->mem_axi4_RDATA, NULL, -1, 4, -1, 0, r_data.get_mpz_t());
+    axi_beat<MEM_AXI_DATA_WIDTH> r_data;
+    r_data.load(memory, pending_read_addr);
+    r_data.mask(r_data.size_strb(pending_read_addr, pending_read_size));
+    r_data.to_signal(top->mem_axi4_RDATA);
     top->mem_axi4_RLAST = pending_read_len == 0;
 
     // RREADY might be stale without eval()
@@ -203,50 +184,12 @@ void step_mem() {
     // WVALID might be stale without eval()
     top->eval();
     if (top->mem_axi4_WVALID) {
-      mpz_class mask = 1;
-      mask <<= 1L << pending_write_size;
-      mask -= 1;
-
-      mpz_class shifted_mask =
-          mask << (pending_write_addr & (MEM_AXI_DATA_BYTES - 1));
-      mpz_class wdata;
-      mpz_import(wdata.get_mpz_t(), MEM_AXI_DATA_BYTES / 4, -1, 4, -1, 0,
-                 top->mem_axi4_WDATA);
-
-      uint64_t aligned =
-          pending_write_addr / MEM_AXI_DATA_BYTES * MEM_AXI_DATA_BYTES;
-      for (int i = 0; i < MEM_AXI_DATA_BYTES / sizeof(mem_t); i++) {
-        uint64_t addr = aligned + i * sizeof(mem_t);
-
-        mpz_class local_wdata_mpz = wdata >> (i * (sizeof(mem_t) * 8));
-        mem_t local_wdata = local_wdata_mpz.get_ui();
-
-        uint64_t local_wstrb =
-            (top->mem_axi4_WSTRB >> (i * sizeof(mem_t))) & 0xfL;
-
-        mpz_class local_mask_mpz = shifted_mask >> (i * sizeof(mem_t));
-        uint64_t local_mask = local_mask_mpz.get_ui() & 0xfL;
-        if (local_mask & local_wstrb) {
-          mem_t base = memory[addr];
-          mem_t input = local_wdata;
-          uint64_t be = local_mask & local_wstrb;
-
-          mem_t muxed = 0;
-          for (int i = 0; i < sizeof(mem_t); i++) {
-            mem_t sel;
-            if (((be >> i) & 1) == 1) {
-              sel = (input >> (i * 8)) & 0xff;
-            } else {
-              sel = (base >> (i * 8)) & 0xff;
-            }
-            muxed |= (sel << (i * 8));
-          }
+      axi_beat<MEM_AXI_DATA_WIDTH> wdata;
+      wdata.from_signal(top->mem_axi4_WDATA);
+      wdata.store(memory, pending_write_addr,
+                  wdata.size_strb(pending_write_addr, pending_write_size) &
+                      top->mem_axi4_WSTRB);
 
-          memory[addr] = muxed;
-        }
-      }
-
-      uint64_t input = wdata.get_ui();
       pending_write_addr += 1L << pending_write_size;
       pending_write_len--;
       if (top->mem_axi4_WLAST) {
@@ -298,36 +241,18 @@ void step_mmio() {
 
     top->mmio_axi4_RVALID = 1;
     top->mmio_axi4_RID = pending_read_id;
-    mpz_class r_data;
+    axi_beat<MMIO_AXI_DATA_WIDTH> r_data;
     if (pending_read_addr == serial_addr + 0x14 ||
         pending_read_addr == serial_fpga_addr + 0x14) {
       // serial lsr
       // THRE | TEMT
       uint64_t lsr = (1L << 5) | (1L << 6);
-      r_data = lsr << 32;
+      r_data.data[0] = lsr << 32;
     } else {
-      uint64_t aligned =
-          (pending_read_addr / MMIO_AXI_DATA_BYTES) * MMIO_AXI_DATA_BYTES;
-      for (int i = 0; i < MMIO_AXI_DATA_BYTES / sizeof(mem_t); i++) {
-        uint64_t addr = aligned + i * sizeof(mem_t);
-        mem_t r = memory[addr];
-        mpz_class res = r;
-        res <<= (i * (sizeof(mem_t) * 8));
-        r_data += res;
-      }
+      r_data.load(memory, pending_read_addr);
     }
-
-    mpz_class mask = 1;
-    mask <<= (1L << pending_read_size) * 8;
-    mask -= 1;
-
-    mpz_class shifted_mask =
-        mask << ((pending_read_addr & (MMIO_AXI_DATA_BYTES - 1)) * 8);
-    r_data &= shifted_mask;
-
-    // top->mmio_axi4_RDATA = r_data & shifted_mask;
-    memset(&top->mmio_axi4_RDATA, 0, sizeof(top->mmio_axi4_RDATA));
-    mpz_export(&top->mmio_axi4_RDATA, NULL, -1, 4, -1, 0, r_data.get_mpz_t());
+    r_data.mask(r_data.size_strb(pending_read_addr, pending_read_size));
+    r_data.to_signal(&top->mmio_axi4_RDATA);
     top->mmio_axi4_RLAST = pending_read_len == 0;
 
     // RREADY might be stale without eval()
@@ -368,50 +293,13 @@ void step_mmio() {
     // WVALID might be stale without eval()
     top->eval();
     if (top->mmio_axi4_WVALID) {
-      mpz_class mask = 1;
-      mask <<= 1L << pending_write_size;
-      mask -= 1;
-
-      mpz_class shifted_mask =
-          mask << (pending_write_addr & (MMIO_AXI_DATA_BYTES - 1));
-      mpz_class wdata;
-      mpz_import(wdata.get_mpz_t(), MMIO_AXI_DATA_BYTES / 4, -1, 4, -1, 0,
-                 &top->mmio_axi4_WDATA);
-
-      uint64_t aligned =
-          pending_write_addr / MMIO_AXI_DATA_BYTES * MMIO_AXI_DATA_BYTES;
-      for (int i = 0; i < MMIO_AXI_DATA_BYTES / sizeof(mem_t); i++) {
-        uint64_t addr = aligned + i * sizeof(mem_t);
-
-        mpz_class local_wdata_mpz = wdata >> (i * (sizeof(mem_t) * 8));
-        mem_t local_wdata = local_wdata_mpz.get_ui();
-
-        uint64_t local_wstrb =
-            (top->mmio_axi4_WSTRB >> (i * sizeof(mem_t))) & 0xfL;
-
-        mpz_class local_mask_mpz = shifted_mask >> (i * sizeof(mem_t));
-        uint64_t local_mask = local_mask_mpz.get_ui() & 0xfL;
-        if (local_mask & local_wstrb) {
-          mem_t base = memory[addr];
-          mem_t input = local_wdata;
-          uint64_t be = local_mask & local_wstrb;
-
-          mem_t muxed = 0;
-          for (int i = 0; i < sizeof(mem_t); i++) {
-            mem_t sel;
-            if (((be >> i) & 1) == 1) {
-              sel = (input >> (i * 8)) & 0xff;
-            } else {
-              sel = (base >> (i * 8)) & 0xff;
-            }
-            muxed |= (sel << (i * 8));
-          }
+      axi_beat<MMIO_AXI_DATA_WIDTH> wdata;
+      wdata.from_signal(&top->mmio_axi4_WDATA);
+      wdata.store(memory, pending_write_addr,
+                  wdata.size_strb(pending_write_addr, pending_write_size) &
+                      top->mmio_axi4_WSTRB);
 
-          memory[addr] = muxed;
-        }
-      }
-
-      uint64_t input = wdata.get_ui();
+      uint64_t input = wdata.data[0];
       if (pending_write_addr == serial_addr ||
           pending_write_addr == serial_fpga_addr) {
         // serial
@@ -444,7 +332,7 @@ void step_mmio() {
         // clear tohost
         for (int i = 0; i < MMIO_AXI_DATA_BYTES / sizeof(mem_t); i++) {
           uint64_t addr = tohost_addr + i * sizeof(mem_t);
-          memory[addr] = 0;
+          memory.write(addr, 0);
         }
       }
 
@@ -504,9 +392,7 @@ void load_file(const std::string &path) {
       offset += read;
     }
 
-    for (int i = 0; i < padded_size; i += sizeof(mem_t)) {
-      memory[addr + i] = *((mem_t *)&buffer[i]);
-    }
+    memory.write_bytes(addr, buffer, padded_size);
     fprintf(stderr, "> Loaded %ld bytes from BIN %s\n", size, path.c_str());
     fclose(fp);
     delete[] buffer;
@@ -553,10 +439,7 @@ void load_file(const std::string &path) {
         size_t offset = hdr->p_offset;
         size_t dest = hdr->p_paddr;
         total_size += size;
-        for (int i = 0; i < size; i += sizeof(mem_t)) {
-          mem_t data = *(mem_t *)&buffer[offset + i];
-          memory[dest + i] = data;
-        }
+        memory.write_bytes(dest, &buffer[offset], size);
       }
     }
 
@@ -1127,8 +1010,8 @@ int main(int argc, char **argv) {
          addr += signature_granularity) {
       uint64_t words = signature_granularity / sizeof(mem_t);
       for (uint64_t i = 0; i < signature_granularity; i += sizeof(mem_t)) {
-        fprintf(fp, "%08lx",
-                memory[addr + signature_granularity - sizeof(mem_t) - i]);
+        fprintf(fp, "%08x",
+                memory.read(addr + signature_granularity - sizeof(mem_t) - i));
       }
       fprintf(fp, "\n");
     }